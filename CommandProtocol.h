@@ -0,0 +1,223 @@
+#ifndef COMMANDPROTOCOL_H
+#define COMMANDPROTOCOL_H
+
+#include "mbed.h"
+
+// Remote control frames, as sent by the operator's Bluetooth app:
+//
+//     0x7E  sequence  length  payload[length]  crc
+//
+// The payload is a batch of commands, each an opcode followed by its
+// arguments (fixed length per opcode, 16-bit values big-endian). The crc is
+// CRC-8 (polynomial 0x07) over sequence, length and payload. The controller
+// only acts on a frame once all of it has arrived and checked out, so a
+// dropped or corrupted byte loses that frame and nothing else, and bytes
+// outside a frame are ignored.
+const uint8_t FRAME_START = 0x7E;
+const int MAX_PAYLOAD = 64;
+const int MAX_BATCH = 16; // Commands in one frame
+
+enum CommandOpcode {
+    CMD_REQUEST_APPROACH = 0x01, // approach (1 = Junction 1): give it the green
+    CMD_PED_REQUEST = 0x02, // Change to the pedestrian crossing
+    CMD_REPORT_SENSORS = 0x03, // Report the IR sensor ambient levels
+    CMD_STOP = 0x04, // Stop all traffic until CMD_GO (emergency)
+    CMD_GO = 0x05, // Restart after CMD_STOP
+    CMD_SET_TIMING = 0x06, // field (TimingField), milliseconds (16 bit)
+    CMD_FORCE_PHASE = 0x07, // phase (1 = first phase in the plan): change to it now
+    CMD_QUERY_COUNTERS = 0x08, // Report the controller's counters
+    CMD_RESET_TIMERS = 0x09, // Restart the safe passage, transition and timeout timers
+    CMD_SET_VEHICLE_LIMIT = 0x0A, // approach, vehicles
+    CMD_DUMP_RECORDING = 0x0B, // Send the traffic recording (binary, see Recording.h)
+    CMD_QUERY_TIMING = 0x0C, // Report how long each stage of the firmware takes (see LoopProfiler.h)
+    CMD_RESET_TIMING = 0x0D, // Start timing afresh
+    CMD_SET_COORDINATION = 0x0E, // field (CoordinationField), tenths of a second (16 bit)
+    CMD_SYNC_CYCLE = 0x0F, // The corridor's common cycle starts now (see Coordination.h)
+    CMD_SET_ADAPTIVE = 0x10, // 1: the optimizer sets green times and vehicle limits, 0: as set by hand
+    CMD_SET_LOW_POWER = 0x11, // 1: pulsed sensing, slowed while the approaches are empty, 0: full rate (see PowerManager.h)
+    CMD_QUERY_POWER = 0x12, // Report the duty cycles and estimated draw since the last report
+    CMD_OPCODE_COUNT
+};
+
+// Which ControllerTiming member CMD_SET_TIMING changes
+enum TimingField {
+    TIMING_SAFE_PASSAGE = 0,
+    TIMING_TRANSITION,
+    TIMING_PED_WAIT,
+    TIMING_TIMEOUT,
+    TIMING_FIELD_COUNT
+};
+
+// Which CoordinationSettings member CMD_SET_COORDINATION changes
+enum CoordinationField {
+    COORD_CYCLE = 0, // 0 leaves the corridor
+    COORD_OFFSET,
+    COORD_BAND,
+    COORD_MIN_SIDE_GREEN,
+    COORD_FIELD_COUNT
+};
+
+inline uint8_t frameCrc8(uint8_t crc, uint8_t byte){
+    crc ^= byte;
+    for(int i = 0; i < 8; i++){
+        crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+    }
+    return crc;
+}
+
+// Build a frame around 'length' bytes of commands, for whatever sends them
+// (the corridor master, the simulator). 'frame' needs room for length + 4 bytes; returns the bytes used.
+inline int encodeFrame(uint8_t sequence, const uint8_t* payload, uint8_t length, uint8_t* frame){
+    frame[0] = FRAME_START;
+    frame[1] = sequence;
+    frame[2] = length;
+    uint8_t crc = frameCrc8(frameCrc8(0, sequence), length);
+    for(int i = 0; i < length; i++){
+        frame[3 + i] = payload[i];
+        crc = frameCrc8(crc, payload[i]);
+    }
+    frame[3 + length] = crc;
+    return length + 4;
+}
+
+struct Command {
+    uint8_t opcode;
+    uint8_t target; // Approach, phase or timing field, where the opcode takes one
+    uint16_t value;
+};
+
+// One frame's worth of commands, applied together.
+struct CommandBatch {
+    uint8_t sequence; // Echoed back in the acknowledgement
+    uint8_t count;
+    Command commands[MAX_BATCH];
+};
+
+enum FrameResult {
+    FRAME_INCOMPLETE, // Nothing yet, keep feeding
+    FRAME_OK, // A batch is ready
+    FRAME_BAD_CHECKSUM, // Frame corrupted, dropped
+    FRAME_BAD_COMMAND, // Frame intact but a command did not decode, dropped
+    FRAME_TOO_MANY // Frame intact but more than MAX_BATCH commands, dropped
+};
+
+// Decodes frames a byte at a time, as the bytes come out of the RX buffer.
+class CommandParser {
+    private:
+    enum State { WAIT_START, READ_SEQUENCE, READ_LENGTH, READ_PAYLOAD, READ_CRC };
+
+    State state;
+    uint8_t sequence;
+    uint8_t length;
+    uint8_t received;
+    uint8_t crc;
+    uint8_t payload[MAX_PAYLOAD];
+    uint32_t discardedBytes; // Bytes that were not part of any frame
+
+    // Argument bytes after each opcode, -1 for opcodes that do not exist.
+    static int argumentLength(uint8_t opcode){
+        static const int8_t lengths[CMD_OPCODE_COUNT] = {
+            -1, // 0x00 unused
+            1, // CMD_REQUEST_APPROACH
+            0, // CMD_PED_REQUEST
+            0, // CMD_REPORT_SENSORS
+            0, // CMD_STOP
+            0, // CMD_GO
+            3, // CMD_SET_TIMING
+            1, // CMD_FORCE_PHASE
+            0, // CMD_QUERY_COUNTERS
+            0, // CMD_RESET_TIMERS
+            2, // CMD_SET_VEHICLE_LIMIT
+            0, // CMD_DUMP_RECORDING
+            0, // CMD_QUERY_TIMING
+            0, // CMD_RESET_TIMING
+            3, // CMD_SET_COORDINATION
+            0, // CMD_SYNC_CYCLE
+            1, // CMD_SET_ADAPTIVE
+            1, // CMD_SET_LOW_POWER
+            0 // CMD_QUERY_POWER
+        };
+        return opcode < CMD_OPCODE_COUNT ? lengths[opcode] : -1;
+    }
+
+    FrameResult decode(CommandBatch& batch){
+        batch.sequence = sequence;
+        batch.count = 0;
+        int i = 0;
+        while(i < length){
+            if(batch.count == MAX_BATCH){
+                return FRAME_TOO_MANY;
+            }
+            Command& command = batch.commands[batch.count];
+            command.opcode = payload[i++];
+            int arguments = argumentLength(command.opcode);
+            if(arguments < 0 || i + arguments > length){
+                return FRAME_BAD_COMMAND;
+            }
+            command.target = arguments >= 1 ? payload[i] : 0;
+            command.value = arguments == 3 ? (uint16_t)((payload[i + 1] << 8) | payload[i + 2])
+                          : arguments == 2 ? payload[i + 1] : 0;
+            i += arguments;
+            batch.count++;
+        }
+        return FRAME_OK;
+    }
+
+    public:
+    CommandParser() : state(WAIT_START), discardedBytes(0) {}
+
+    // Take the next received byte. Once a whole frame is in, returns FRAME_OK
+    // with the commands in 'batch', or why the frame was dropped.
+    FrameResult feed(uint8_t byte, CommandBatch& batch){
+        switch(state){
+            case WAIT_START:
+                if(byte == FRAME_START){
+                    state = READ_SEQUENCE;
+                } else {
+                    discardedBytes++;
+                }
+                return FRAME_INCOMPLETE;
+            case READ_SEQUENCE:
+                sequence = byte;
+                crc = frameCrc8(0, byte);
+                state = READ_LENGTH;
+                return FRAME_INCOMPLETE;
+            case READ_LENGTH:
+                if(byte > MAX_PAYLOAD){
+                    // Can't be a real frame; look for the next start
+                    discardedBytes += 3;
+                    state = WAIT_START;
+                    return FRAME_INCOMPLETE;
+                }
+                length = byte;
+                received = 0;
+                crc = frameCrc8(crc, byte);
+                state = length ? READ_PAYLOAD : READ_CRC;
+                return FRAME_INCOMPLETE;
+            case READ_PAYLOAD:
+                payload[received++] = byte;
+                crc = frameCrc8(crc, byte);
+                if(received == length){
+                    state = READ_CRC;
+                }
+                return FRAME_INCOMPLETE;
+            case READ_CRC:
+            default:
+                state = WAIT_START;
+                if(byte != crc){
+                    return FRAME_BAD_CHECKSUM;
+                }
+                return decode(batch);
+        }
+    }
+
+    uint8_t lastSequence(){
+        return sequence;
+    }
+
+    uint32_t discarded(){
+        return discardedBytes;
+    }
+};
+
+#endif
@@ -0,0 +1,751 @@
+#ifndef CONTROLLER_H
+#define CONTROLLER_H
+
+#include "mbed.h"
+#include "Coordination.h"
+#include "GreenTimeOptimizer.h"
+#include "Junction.h"
+#include "LoopProfiler.h"
+#include "PedestrianCrossing.h"
+#include "PhasePlan.h"
+#include "RingBuffer.h"
+#include "Scheduler.h"
+#include "SensorFrame.h"
+#include "Telemetry.h"
+#include "TrafficRecorder.h"
+
+// Timings shared by every approach, in seconds.
+struct ControllerTiming {
+    float safePassageTime; // How long a green is held once another approach is waiting (initially, with an optimizer)
+    float transitionTime; // How long all lights red between transitions
+    float pedWaitLimit; // How long a pedestrian waits before changing
+    float timeoutTime; // How long before lights change back to the default phase
+};
+
+// Running totals since power up, for remote queries.
+struct ControllerCounters {
+    uint32_t phaseChanges;
+    uint32_t limitTriggers; // Changes forced by a surplus vehicle limit
+    uint32_t timeouts; // Reverted to the default phase
+    uint32_t pedCrossings;
+    uint32_t emergencyStops;
+};
+
+// Runs the whole intersection from a phase plan. Every approach goes through
+// the same code, so adding one is a new Junction and a new row in the plan.
+class Controller {
+    private:
+    Junction* approaches; // One per approach, in phase plan order
+    PhasePlan plan;
+    PedestrianCrossing* ped; // May be NULL at sites without a crossing
+    Scheduler* scheduler;
+    Telemetry* telemetry;
+    GreenTimeOptimizer* optimizer; // May be NULL for fixed timing
+    TrafficRecorder* recorder; // May be NULL if nothing is recorded
+    LoopProfiler* profiler; // May be NULL if nothing is timed
+
+    SensorFrame frame; // Snapshot the current pass works from, see captureFrame()
+
+    // Sensor edges, from the sampling interrupt to captureFrame()
+    RingBuffer<SensorEdge, 64> edges;
+    volatile uint32_t edgesLost; // Edges dropped on a full queue (counts stay exact, timings skip them)
+    volatile bool pulsedSensing; // Low power: each sample a pulse of every emitter at once
+    Timeout pulseTimeout; // Ends the pulse once the emitters have settled
+
+    // Per approach, what the edges have shown so far
+    struct EdgeHistory {
+        uint32_t lastArrival;
+        uint32_t lastDeparture;
+        bool arrived; // lastArrival is valid
+        bool departed; // lastDeparture is valid
+    };
+    EdgeHistory history[MAX_APPROACHES];
+
+    int loggedGreens[MAX_PHASES]; // Green times last reported, in whole seconds
+
+    int activePhase; // Phase currently green (or last green, while changing)
+    int targetPhase; // Phase being changed to, NO_PHASE if none
+    bool emergency; // All red, held until resume()
+    bool adaptive; // Green times and vehicle limits from the optimizer, rather than as set
+    float greenTime; // How long the active phase is held once another approach is waiting
+    CycleClock cycle; // Position in the corridor's common cycle, when coordinated
+
+    DeadlineTimer safePassageTimer;
+    DeadlineTimer transitionTimer;
+    DeadlineTimer timeoutJunctionTimer;
+
+    static uint8_t bit(int approach){
+        return (uint8_t)(1 << approach);
+    }
+
+    // On a corridor's common cycle: synced, and with settings that leave room
+    // for every phase and the crossing. Otherwise the junction runs on its own.
+    bool coordinated(){
+        if(!cycle.isActive()){
+            return false;
+        }
+        const CoordinationSettings& c = cycle.settings;
+        float side = 2 * timing.transitionTime + c.minSideGreen;
+        float crossing = ped ? timing.transitionTime + ped->duration() : 0;
+        return c.band + (side > crossing ? side : crossing) <= c.cycle;
+    }
+
+    void record(RecordKind kind, int index = 0, int value = 0, uint32_t time = us_ticker_read()){
+        if(recorder){
+            recorder->record(kind, index, value, scheduler->sincePowerUp(time));
+        }
+    }
+
+    // Turn one sensor edge into occupancy, gap and departure interval.
+    void measureEdge(const SensorEdge& edge){
+        int a = edge.approach;
+        EdgeHistory& h = history[a];
+        if(edge.arrived){
+            if(h.departed){
+                frame.gap[a] = edge.time - h.lastDeparture;
+            }
+            if(frame.arrivals[a] < 255){
+                frame.arrivals[a]++;
+            }
+            h.lastArrival = edge.time;
+            h.arrived = true;
+        } else {
+            if(h.arrived){
+                frame.occupancy[a] = edge.time - h.lastArrival;
+            }
+            record(REC_DEPARTURE, a, h.arrived ? (frame.occupancy[a] + 50000) / 100000 : 0, edge.time);
+            if(h.departed){
+                frame.departureInterval[a] = edge.time - h.lastDeparture;
+            }
+            h.lastDeparture = edge.time;
+            h.departed = true;
+        }
+    }
+
+    // Read every approach once, for this pass to work from.
+    void captureFrame(){
+        frame.capturedAt = us_ticker_read();
+        frame.uptime = scheduler->sincePowerUp(frame.capturedAt);
+        frame.approachCount = plan.approachCount;
+        frame.present = 0;
+        frame.green = 0;
+        frame.departed = 0;
+        for(int a = 0; a < plan.approachCount; a++){
+            frame.arrivals[a] = 0;
+        }
+        SensorEdge edge;
+        while(edges.pop(edge)){
+            measureEdge(edge);
+        }
+        for(int a = 0; a < plan.approachCount; a++){
+            Junction& junction = approaches[a];
+            int departed = junction.takeDepartures();
+            frame.departures[a] = (uint8_t)(departed > 255 ? 255 : departed);
+            if(departed){
+                frame.departed |= bit(a);
+            }
+            if(junction.isVehicleWaiting()){
+                frame.present |= bit(a);
+            }
+            if(junction.isGreen()){
+                frame.green |= bit(a);
+            }
+        }
+    }
+
+    // Next phase to serve: remote requests first, then the next requested phase
+    // after the active one, so every waiting approach gets its turn.
+    int choosePhase(uint8_t requested, uint8_t remote){
+        uint8_t masks[2] = { remote, requested };
+        for(int m = 0; m < 2; m++){
+            for(int i = 1; i <= plan.phaseCount; i++){
+                int p = (activePhase + i) % plan.phaseCount;
+                if(plan.phases[p] & masks[m]){
+                    return p;
+                }
+            }
+        }
+        return NO_PHASE;
+    }
+
+    // Latch requests from red approaches. The change goes ahead even if the
+    // vehicle pulls away, so the lights never stay red on someone.
+    void latchRequests(uint8_t waiting, uint8_t green, uint8_t& requested, uint8_t& remote){
+        requested = 0;
+        remote = 0;
+        for(int a = 0; a < plan.approachCount; a++){
+            Junction& junction = approaches[a];
+            if(green & bit(a)){
+                continue;
+            }
+            // Only log a waiting vehicle once per change
+            if((waiting & bit(a)) && !junction.changeTriggered){
+                telemetry->log(MSG_VEHICLE_WAITING, junction.name());
+            }
+            if((waiting & bit(a)) || junction.remoteTrigger){
+                junction.changeTriggered = true;
+            }
+            if(junction.changeTriggered){
+                requested |= bit(a);
+            }
+            if(junction.remoteTrigger){
+                remote |= bit(a);
+            }
+        }
+    }
+
+    // Phase to resume into after an emergency stop: one asked for remotely,
+    // otherwise the one with the most traffic held up (by estimated queue, with
+    // an optimizer), otherwise the default phase.
+    int bestPhase(){
+        int best = plan.defaultPhase;
+        float bestScore = 0;
+        for(int i = 0; i < plan.phaseCount; i++){
+            int p = (plan.defaultPhase + i) % plan.phaseCount; // Default phase wins a tie
+            float score = 0;
+            for(int a = 0; a < plan.approachCount; a++){
+                Junction& junction = approaches[a];
+                if(!(plan.phases[p] & bit(a))){
+                    continue;
+                }
+                if(junction.remoteTrigger){
+                    score += 1000;
+                } else if(junction.changeTriggered){
+                    score += 1 + (optimizer ? optimizer->queueEstimate(a, frame.uptime) : 0);
+                }
+            }
+            if(score > bestScore){
+                best = p;
+                bestScore = score;
+            }
+        }
+        return best;
+    }
+
+    // A green approach that has let its allowance of vehicles through, or -1 if none has.
+    int surplusLimitReached(uint8_t green){
+        for(int a = 0; a < plan.approachCount; a++){
+            Junction& junction = approaches[a];
+            if((green & bit(a)) && junction.vehicleCounterStarted && junction.surplusVehicleCount >= junction.surplusVehicleLimit){
+                return a;
+            }
+        }
+        return -1;
+    }
+
+    // Set the green time and vehicle limits for a phase about to go green. Back at
+    // the default phase a cycle is complete, so the optimizer retimes first.
+    void timePhase(int phase){
+        if(!optimizer || !adaptive){
+            greenTime = timing.safePassageTime;
+            return;
+        }
+        if(phase == plan.defaultPhase && optimizer->retime(frame.uptime)){
+            for(int p = 0; p < plan.phaseCount; p++){
+                int seconds = (int)(optimizer->greenTime(p) + 0.5f);
+                if(seconds != loggedGreens[p]){
+                    loggedGreens[p] = seconds;
+                    telemetry->log(MSG_GREEN_TIME, approaches[firstApproach(p)].name(), seconds);
+                    record(REC_GREEN_TIME, p, seconds);
+                }
+            }
+        }
+        greenTime = optimizer->greenTime(phase);
+        if(!optimizer->hasMeasured()){
+            return;
+        }
+        for(int a = 0; a < plan.approachCount; a++){
+            if(plan.phases[phase] & bit(a)){
+                approaches[a].surplusVehicleLimit = optimizer->vehicleLimit(a, phase, frame.uptime);
+            }
+        }
+    }
+
+    int firstApproach(int phase){
+        for(int a = 0; a < plan.approachCount; a++){
+            if(plan.phases[phase] & bit(a)){
+                return a;
+            }
+        }
+        return 0;
+    }
+
+    void enterPhase(int phase){
+        timePhase(phase);
+        for(int a = 0; a < plan.approachCount; a++){
+            Junction& junction = approaches[a];
+            if(plan.phases[phase] & bit(a)){
+                junction.changeGreen();
+                junction.changeTriggered = false;
+                junction.remoteTrigger = false;
+            }
+            junction.stopVehicleCounter();
+        }
+        activePhase = phase;
+        targetPhase = NO_PHASE;
+        counters.phaseChanges++;
+        record(REC_PHASE, phase);
+
+        //Reset Timers
+        transitionTimer.stop();
+        transitionTimer.reset();
+        safePassageTimer.stop();
+        safePassageTimer.reset();
+
+        //Start timer to transition back, this makes the default phase the primarily green.
+        timeoutJunctionTimer.stop();
+        timeoutJunctionTimer.reset();
+        if(phase != plan.defaultPhase){
+            timeoutJunctionTimer.start();
+        }
+
+        // Come straight back: approaches already waiting need their timers started
+        scheduler->post(EVENT_RERUN);
+    }
+
+    public:
+    ControllerTiming timing;
+    ControllerCounters counters;
+
+    // Pass an optimizer to have green times and vehicle limits follow the traffic,
+    // or NULL to keep timing.safePassageTime and each approach's own limit. Pass
+    // a recorder to keep a history of the traffic and the controller's decisions,
+    // and a profiler to time the sampling interrupt and the sensing.
+    Controller(Junction* _approaches, PhasePlan _plan, PedestrianCrossing* _ped, ControllerTiming _timing, Scheduler* _scheduler, Telemetry* _telemetry, GreenTimeOptimizer* _optimizer = NULL, TrafficRecorder* _recorder = NULL, LoopProfiler* _profiler = NULL)
+    : approaches(_approaches)
+    , plan(_plan)
+    , ped(_ped)
+    , scheduler(_scheduler)
+    , telemetry(_telemetry)
+    , optimizer(_optimizer)
+    , recorder(_recorder)
+    , profiler(_profiler)
+    , edgesLost(0)
+    , pulsedSensing(false)
+    , activePhase(_plan.defaultPhase)
+    , targetPhase(NO_PHASE)
+    , emergency(false)
+    , adaptive(true)
+    , greenTime(_timing.safePassageTime)
+    , timing(_timing) {
+        for(int p = 0; p < MAX_PHASES; p++){
+            loggedGreens[p] = -1;
+        }
+        counters.phaseChanges = 0;
+        counters.limitTriggers = 0;
+        counters.timeouts = 0;
+        counters.pedCrossings = 0;
+        counters.emergencyStops = 0;
+        for(int a = 0; a < MAX_APPROACHES; a++){
+            history[a].arrived = false;
+            history[a].departed = false;
+            frame.occupancy[a] = 0;
+            frame.gap[a] = 0;
+            frame.departureInterval[a] = 0;
+        }
+        captureFrame();
+    }
+
+    int approachCount(){
+        return plan.approachCount;
+    }
+
+    int phaseCount(){
+        return plan.phaseCount;
+    }
+
+    Junction& approach(int a){
+        return approaches[a];
+    }
+
+    // The frame the last pass worked from.
+    const SensorFrame& lastFrame(){
+        return frame;
+    }
+
+    // Initial Start: straight to the default phase
+    void start(){
+        enterPhase(plan.defaultPhase);
+    }
+
+    // Queue a sensor's change of state and say whether there was one.
+    bool noteEdge(int a, bool changed, uint32_t now){
+        if(!changed){
+            return false;
+        }
+        SensorEdge edge;
+        edge.time = now;
+        edge.approach = (uint8_t)a;
+        edge.arrived = approaches[a].isVehicleWaiting();
+        if(!edges.push(edge)){
+            edgesLost++;
+        }
+        return true;
+    }
+
+    // Sensor ticker interrupt: sample every approach, queue the time of every
+    // change, and wake the main loop. With pulsed sensing it lights every
+    // emitter together and leaves the lit readings to finishPulse().
+    void sampleSensors(){
+        uint32_t began = profiler ? profiler->begin() : 0;
+        bool changed = false;
+        uint32_t now = us_ticker_read();
+        if(pulsedSensing){
+            for(int a = 0; a < plan.approachCount; a++){
+                approaches[a].startPulse();
+            }
+            pulseTimeout.attach_us(callback(this, &Controller::finishPulse), EMITTER_SETTLE_US);
+        } else {
+            for(int a = 0; a < plan.approachCount; a++){
+                changed = noteEdge(a, approaches[a].sampleSensor(), now) || changed;
+            }
+        }
+        if(changed){
+            scheduler->post(EVENT_SENSOR);
+        }
+        if(profiler){
+            profiler->tick(PERIOD_SAMPLING);
+            profiler->end(STAGE_SAMPLING, began);
+        }
+    }
+
+    // Timeout interrupt, EMITTER_SETTLE_US into a pulse: the lit readings.
+    void finishPulse(){
+        uint32_t began = profiler ? profiler->begin() : 0;
+        bool changed = false;
+        uint32_t now = us_ticker_read();
+        for(int a = 0; a < plan.approachCount; a++){
+            changed = noteEdge(a, approaches[a].finishPulse(), now) || changed;
+        }
+        if(changed){
+            scheduler->post(EVENT_SENSOR);
+        }
+        if(profiler){
+            profiler->end(STAGE_SAMPLING, began);
+        }
+    }
+
+    // Low power: pulse the emitters each sample rather than alternate them.
+    void setPulsedSensing(bool on){
+        pulsedSensing = on;
+    }
+
+    // One pass of the control logic. Call whenever the scheduler wakes.
+    void update(){
+        // Sample every approach once; everything below works from this frame
+        uint32_t began = profiler ? profiler->begin() : 0;
+        captureFrame();
+        for(int a = 0; a < plan.approachCount; a++){
+            if(frame.departed & bit(a)){
+                approaches[a].countDepartures(frame.departures[a]);
+            }
+        }
+        if(optimizer){
+            optimizer->observe(frame);
+        }
+        if(profiler){
+            profiler->end(STAGE_SENSING, began);
+        }
+        const uint8_t waiting = frame.present; // Approaches with a vehicle at the sensor
+        const uint8_t green = frame.green; // Approaches on green
+        uint8_t requested; // Approaches with a change latched
+        uint8_t remote; // Approaches asked for remotely
+
+        // Emergency stop: the lights stay red, but requests are latched as usual
+        // so the queues are known when traffic resumes
+        if(emergency){
+            latchRequests(waiting, green, requested, remote);
+            return;
+        }
+
+        if(ped){
+            // While pedestrians are crossing, keep counting vehicles but leave the signals alone,
+            // then give the default phase the green once the crossing has cleared
+            if(ped->isActive()){
+                if(ped->update()){
+                    record(REC_PED_CLEAR);
+                    enterPhase(plan.defaultPhase);
+                }
+                return;
+            }
+
+            //Check Pedestrian Waiting Timer (or remote trigger). On a common cycle the
+            //crossing waits for a gap it fits in, unless asked for remotely.
+            bool pedDue = ped->waitingTimer.read() > timing.pedWaitLimit;
+            if(pedDue && coordinated() && !cycle.fits(frame.capturedAt, timing.transitionTime + ped->duration())){
+                pedDue = false;
+            }
+            if(pedDue || ped->remoteTrigger){
+                allRed();
+                // Before changing green, make sure suitable time passed.
+                transitionTimer.start();
+                if(transitionTimer > timing.transitionTime){
+                    ped->changeGreen();
+                    counters.pedCrossings++;
+                    record(REC_PED_WALK);
+                    //Reset Timers and Triggers
+                    transitionTimer.stop();
+                    transitionTimer.reset();
+                    ped->remoteTrigger = false;
+                }
+                return;
+            }
+        }
+
+        latchRequests(waiting, green, requested, remote);
+
+        // Only while a vehicle waits on red do green approaches count cars, starting
+        // once the green is clear (to account for the vehicle already there)
+        if(waiting & ~green){
+            for(int a = 0; a < plan.approachCount; a++){
+                if((green & bit(a)) && !(waiting & bit(a)) && !approaches[a].vehicleCounterStarted){
+                    approaches[a].startVehicleCounter();
+                }
+            }
+        }
+
+        // Away from the default phase: vehicles using the green hold it, otherwise time out back to default
+        if(activePhase != plan.defaultPhase && targetPhase == NO_PHASE){
+            if(waiting & green){
+                timeoutJunctionTimer.stop();
+                timeoutJunctionTimer.reset();
+                timeoutJunctionTimer.start();
+            }
+            if(timeoutJunctionTimer > timing.timeoutTime){
+                uint8_t home = plan.phases[plan.defaultPhase];
+                for(int a = 0; a < plan.approachCount; a++){
+                    if((home & bit(a)) && !(green & bit(a))){
+                        approaches[a].remoteTrigger = true;
+                        approaches[a].changeTriggered = true;
+                        requested |= bit(a);
+                        remote |= bit(a);
+                    }
+                }
+                telemetry->log(MSG_TIMED_OUT, approaches[firstApproach(plan.defaultPhase)].name());
+                record(REC_TIMEOUT);
+                counters.timeouts++;
+                timeoutJunctionTimer.stop();
+                timeoutJunctionTimer.reset();
+            }
+            // On a common cycle, back to the default phase in time for it to go green on the offset
+            if(coordinated() && !cycle.sideWindowOpen(frame.capturedAt, timing.transitionTime)){
+                uint8_t home = plan.phases[plan.defaultPhase];
+                for(int a = 0; a < plan.approachCount; a++){
+                    if((home & bit(a)) && !(green & bit(a))){
+                        approaches[a].remoteTrigger = true;
+                        approaches[a].changeTriggered = true;
+                        requested |= bit(a);
+                        remote |= bit(a);
+                    }
+                }
+            }
+        }
+
+        if(targetPhase == NO_PHASE){
+            int next = choosePhase(requested, remote);
+            if(next == NO_PHASE){
+                return;
+            }
+            // Continue if safety timer elapsed, or vehicle limit reached, or remotely operated.
+            int limited = surplusLimitReached(green);
+            bool due = safePassageTimer > greenTime || limited >= 0;
+            if(coordinated() && next != plan.defaultPhase){
+                // On a common cycle the default phase holds its band whatever the
+                // traffic, and other phases only start if they can finish in time
+                if(activePhase == plan.defaultPhase){
+                    limited = -1;
+                    due = true;
+                }
+                due = due && cycle.fits(frame.capturedAt, 2 * timing.transitionTime + cycle.settings.minSideGreen);
+            }
+            if(due || (plan.phases[next] & remote)){
+                if(limited >= 0){
+                    telemetry->log(MSG_VEHICLE_LIMIT, approaches[limited].name());
+                    record(REC_VEHICLE_LIMIT, limited);
+                    counters.limitTriggers++;
+                }
+                targetPhase = next;
+                record(REC_CHANGE, next);
+                timeoutJunctionTimer.stop();
+                timeoutJunctionTimer.reset();
+                // Nothing to clear (e.g. everything is already red): go straight there
+                if(!(green & ~plan.phases[next]) && !transitionTimer.isRunning()){
+                    enterPhase(next);
+                    return;
+                }
+            } else {
+                // If not, and the timer has not started, start it
+                safePassageTimer.start();
+                return;
+            }
+        }
+
+        // Red for everything outside the target phase, then hold for the transition time
+        for(int a = 0; a < plan.approachCount; a++){
+            if((green & bit(a)) && !(plan.phases[targetPhase] & bit(a))){
+                approaches[a].changeRed();
+            }
+        }
+        transitionTimer.start();
+        if(transitionTimer > timing.transitionTime){
+            enterPhase(targetPhase);
+        }
+    }
+
+    // Wake the scheduler when the nearest running timer is due.
+    void watchDeadlines(){
+        scheduler->watch(safePassageTimer, greenTime);
+        scheduler->watch(transitionTimer, timing.transitionTime);
+        scheduler->watch(timeoutJunctionTimer, timing.timeoutTime);
+        if(ped){
+            scheduler->watch(ped->waitingTimer, timing.pedWaitLimit);
+            scheduler->watch(ped->phaseTimer, ped->phaseLimit());
+        }
+        if(coordinated()){
+            scheduler->watchIn(cycle.untilNextBoundary(us_ticker_read(), timing.transitionTime) + 0.001f);
+        }
+        scheduler->armDeadline();
+    }
+
+    // Remote request for an approach to be given the green.
+    void requestApproach(int a){
+        if(a >= 0 && a < plan.approachCount){
+            approaches[a].remoteTrigger = true;
+        }
+    }
+
+    // Remote request for a whole phase to be given the green.
+    void forcePhase(int phase){
+        if(phase < 0 || phase >= plan.phaseCount){
+            return;
+        }
+        for(int a = 0; a < plan.approachCount; a++){
+            if(plan.phases[phase] & bit(a)){
+                approaches[a].remoteTrigger = true;
+            }
+        }
+    }
+
+    // Stop all traffic, abandoning any change in progress.
+    void allRed(){
+        for(int a = 0; a < plan.approachCount; a++){
+            approaches[a].changeRed();
+        }
+        targetPhase = NO_PHASE;
+    }
+
+    // Emergency all red: every signal and the crossing to red at once, and held
+    // there until resume(). Sensing, counting and telemetry carry on as normal.
+    void emergencyStop(){
+        if(emergency){
+            return;
+        }
+        allRed();
+        if(ped){
+            ped->abort();
+            ped->showStatus("E"); // Tell pedestrians why nothing is moving
+        }
+        resetTimers();
+        transitionTimer.start(); // Time the all red, so resuming only waits out what is left of it
+        emergency = true;
+        counters.emergencyStops++;
+        telemetry->log(MSG_STOPPED);
+        record(REC_STOP);
+    }
+
+    // Leave the emergency stop, straight into the phase that needs it most (or
+    // the pedestrian crossing, if it has waited its time).
+    void resume(){
+        if(!emergency){
+            return;
+        }
+        emergency = false;
+        if(ped){
+            ped->showStatus("");
+        }
+        targetPhase = bestPhase();
+        record(REC_RESUME, targetPhase);
+        if(ped && (ped->waitingTimer.read() > timing.pedWaitLimit || ped->remoteTrigger)){
+            telemetry->log(MSG_RESTARTED, "Pedestrian Crossing"); // Has waited its time, so goes before any phase
+        } else {
+            telemetry->log(MSG_RESTARTED, approaches[firstApproach(targetPhase)].name());
+        }
+        scheduler->post(EVENT_RERUN);
+    }
+
+    bool isStopped(){
+        return emergency;
+    }
+
+    // Off holds timing.safePassageTime and each approach's own vehicle limit, as
+    // set by hand; the optimizer keeps measuring, to take over again when on.
+    void setAdaptive(bool on){
+        adaptive = on;
+    }
+
+    bool isAdaptive(){
+        return adaptive;
+    }
+
+    // The common cycles this site could run with 'settings', adaptive or not, in
+    // seconds: from every phase (and the crossing) at its shortest, up to that
+    // plus the longest green. Taken as arguments so a frame can be checked
+    // against the timing it leaves, before any of it is applied.
+    float shortestCycle(const ControllerTiming& settings, bool withOptimizer){
+        float minGreen = optimizer && withOptimizer ? optimizer->limits().minGreen : settings.safePassageTime;
+        float total = plan.phaseCount * (settings.transitionTime + minGreen);
+        return ped ? total + settings.transitionTime + ped->duration() : total;
+    }
+
+    float longestCycle(const ControllerTiming& settings, bool withOptimizer){
+        float maxGreen = optimizer && withOptimizer ? optimizer->limits().maxGreen : settings.safePassageTime;
+        return shortestCycle(settings, withOptimizer) + maxGreen;
+    }
+
+    // Corridor settings, taking effect from the next syncCycle().
+    void coordinate(const CoordinationSettings& settings){
+        cycle.configure(settings);
+    }
+
+    const CoordinationSettings& coordination(){
+        return cycle.settings;
+    }
+
+    // The corridor's common cycle starts now.
+    void syncCycle(){
+        if(cycle.sync(us_ticker_read()) && cycle.settings.cycle > 0){
+            telemetry->log(MSG_COORDINATED, approaches[firstApproach(plan.defaultPhase)].name(), (int)(cycle.settings.offset + 0.5f));
+        }
+        scheduler->post(EVENT_RERUN);
+    }
+
+    void resetTimers(){
+        safePassageTimer.stop();
+        safePassageTimer.reset();
+        transitionTimer.stop();
+        transitionTimer.reset();
+        timeoutJunctionTimer.stop();
+        timeoutJunctionTimer.reset();
+    }
+
+    void reportCounters(){
+        for(int a = 0; a < plan.approachCount; a++){
+            telemetry->log(MSG_VEHICLE_COUNT, approaches[a].name(), approaches[a].vehiclesCounted());
+        }
+        telemetry->log(MSG_COUNTER, "Phase changes", counters.phaseChanges);
+        telemetry->log(MSG_COUNTER, "Vehicle limit changes", counters.limitTriggers);
+        telemetry->log(MSG_COUNTER, "Timeouts", counters.timeouts);
+        telemetry->log(MSG_COUNTER, "Pedestrian crossings", counters.pedCrossings);
+        telemetry->log(MSG_COUNTER, "Emergency stops", counters.emergencyStops);
+        telemetry->log(MSG_COUNTER, "Sensor edges lost", edgesLost);
+    }
+
+    void reportSensors(){
+        for(int a = 0; a < plan.approachCount; a++){
+            approaches[a].ReportSensor();
+            record(REC_AMBIENT, a, approaches[a].ambientLevel());
+        }
+    }
+};
+
+#endif
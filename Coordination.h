@@ -0,0 +1,99 @@
+#ifndef COORDINATION_H
+#define COORDINATION_H
+
+#include "mbed.h"
+
+// Running as one of a corridor of signals. Every site shares a common cycle,
+// started by a sync frame over the radio link, and turns its default phase
+// green 'offset' seconds into it. With the offsets set to the travel time from
+// the first site, a platoon released by one green arrives on green at the next.
+struct CoordinationSettings {
+    float cycle; // Common cycle length, seconds; 0 runs the junction on its own. A minute or two (see Controller::longestCycle), well inside the microsecond timer
+    float offset; // When this site's default phase turns green, seconds into the common cycle; less than the cycle
+    float band; // Default phase green guaranteed from then on, for the platoon to get through
+    float minSideGreen; // Shortest green worth leaving the default phase for
+};
+
+// This site's position in the common cycle.
+class CycleClock {
+    private:
+    uint32_t cycleStart; // us_ticker_read() when this site's cycle last started
+    bool synced;
+
+    uint32_t cycleMicroseconds(){
+        return (uint32_t)(settings.cycle * 1e6f);
+    }
+
+    public:
+    CoordinationSettings settings;
+
+    CycleClock() : cycleStart(0), synced(false) {
+        settings.cycle = 0;
+        settings.offset = 0;
+        settings.band = 0;
+        settings.minSideGreen = 0;
+    }
+
+    // The common cycle started at 'now' (us_ticker_read()). Returns true the first
+    // time, when the site joins the corridor.
+    bool sync(uint32_t now){
+        cycleStart = now + (uint32_t)(settings.offset * 1e6f);
+        bool joined = !synced;
+        synced = true;
+        return joined;
+    }
+
+    // New settings take effect from the next sync.
+    void configure(const CoordinationSettings& _settings){
+        settings = _settings;
+        synced = false;
+    }
+
+    bool isActive(){
+        return synced && settings.cycle > 0;
+    }
+
+    // Seconds since this site's default phase was due green.
+    float position(uint32_t now){
+        uint32_t length = cycleMicroseconds();
+        uint32_t elapsed = now - cycleStart;
+        if((int32_t)elapsed < 0){
+            // Before the first cycle after a sync: count back from its start
+            return settings.cycle - (uint32_t)(cycleStart - now) % length / 1e6f;
+        }
+        if(elapsed >= length){
+            cycleStart += elapsed / length * length; // Keep the count short, so it never wraps
+            elapsed = now - cycleStart;
+        }
+        return elapsed / 1e6f;
+    }
+
+    // Whether something taking 'needs' seconds (clearance in, green, clearance
+    // back) may start now: the band is over, and it ends before the default
+    // phase is due again.
+    bool fits(uint32_t now, float needs){
+        float t = position(now);
+        return t >= settings.band && t + needs <= settings.cycle;
+    }
+
+    // Whether anything but the default phase may still be green: only after the
+    // band, and not into the clearance before the default phase is due.
+    bool sideWindowOpen(uint32_t now, float clearance){
+        float t = position(now);
+        return t >= settings.band && t < settings.cycle - clearance;
+    }
+
+    // Seconds to the next point where either answer can change.
+    float untilNextBoundary(uint32_t now, float clearance){
+        float t = position(now);
+        float points[3] = { settings.band, settings.cycle - clearance, settings.cycle };
+        for(int i = 0; i < 3; i++){
+            if(points[i] > t){
+                return points[i] - t;
+            }
+        }
+        return settings.cycle - t + settings.band;
+    }
+};
+
+#endif
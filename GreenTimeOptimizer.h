@@ -0,0 +1,219 @@
+#ifndef GREENTIMEOPTIMIZER_H
+#define GREENTIMEOPTIMIZER_H
+
+#include "mbed.h"
+#include "PhasePlan.h"
+#include "SensorFrame.h"
+
+// Limits the optimizer works within, in seconds.
+struct OptimizerSettings {
+    float minGreen; // Shortest green a phase is held for a waiting approach
+    float maxGreen; // Longest green a phase is held for a waiting approach
+    float lostTime; // Time each phase change costs the intersection (all red plus start-up)
+    float maxCycle; // Longest cycle Webster's formula may ask for
+    float defaultHeadway; // Seconds per vehicle leaving a queue, until one is measured
+};
+
+// Works out green times from the traffic the sensors actually see, using
+// Webster's method. Every control pass feeds it the sensor frame, from which it
+// keeps per approach:
+//  - flow: vehicles per second, from the departures over a whole cycle (over a
+//    cycle everything that arrives also leaves, so this is the arrival rate);
+//  - headway: seconds between vehicles leaving a queue, from the interval
+//    between back to back departures on green (timed from the sensor edges),
+//    i.e. the saturation flow;
+//  - queue: with one detector at the stop line the back of the queue can't be
+//    seen, so it is estimated as flow times the time spent on red.
+// Once a cycle (on return to the default phase) the flow ratios give Webster's
+// optimum cycle, (1.5L + 5) / (1 - Y), which is shared between the phases in
+// proportion to their busiest approach.
+class GreenTimeOptimizer {
+    private:
+    PhasePlan plan;
+    OptimizerSettings settings;
+
+    uint16_t windowDepartures[MAX_APPROACHES]; // Vehicles counted since the last retime
+    float flow[MAX_APPROACHES]; // Smoothed arrival rate, vehicles per second
+    float headway[MAX_APPROACHES]; // Smoothed saturation headway, seconds per vehicle
+    uint64_t redSince[MAX_APPROACHES]; // Frame uptime when the approach last turned red
+    uint8_t timingDepartures; // Approaches whose next departure gives a headway sample
+    uint8_t wasGreen; // Green approaches in the previous frame
+    uint64_t windowStart; // Frame uptime at the last retime
+    bool started;
+    bool measured; // Flows have been through at least one retime
+
+    float greens[MAX_PHASES]; // Current green time for each phase
+    float cycle; // Current cycle length
+
+    static uint8_t bit(int approach){
+        return (uint8_t)(1 << approach);
+    }
+
+    // In 64 bits, so a window left overnight without a retime stays its real length.
+    static float seconds(uint64_t from, uint64_t to){
+        return to > from ? (to - from) / 1000000.0f : 0;
+    }
+
+    // Flow ratio of a phase: the share of the time its busiest approach needs green.
+    float flowRatio(int phase){
+        float ratio = 0;
+        for(int a = 0; a < plan.approachCount; a++){
+            if(plan.phases[phase] & bit(a)){
+                float y = flow[a] * headway[a];
+                if(y > ratio){
+                    ratio = y;
+                }
+            }
+        }
+        return ratio;
+    }
+
+    float clampGreen(float green){
+        return green < settings.minGreen ? settings.minGreen : (green > settings.maxGreen ? settings.maxGreen : green);
+    }
+
+    public:
+    // Until the first full cycle has been measured every phase gets 'initialGreen'.
+    GreenTimeOptimizer(PhasePlan _plan, OptimizerSettings _settings, float initialGreen)
+    : plan(_plan)
+    , settings(_settings)
+    , timingDepartures(0)
+    , wasGreen(0)
+    , windowStart(0)
+    , started(false)
+    , measured(false)
+    , cycle(0) {
+        for(int a = 0; a < MAX_APPROACHES; a++){
+            windowDepartures[a] = 0;
+            flow[a] = 0;
+            headway[a] = settings.defaultHeadway;
+            redSince[a] = 0;
+        }
+        for(int p = 0; p < MAX_PHASES; p++){
+            greens[p] = clampGreen(initialGreen);
+        }
+    }
+
+    // Take in one control pass worth of sensor data.
+    void observe(const SensorFrame& frame){
+        uint64_t now = frame.uptime;
+        if(!started){
+            windowStart = now;
+            for(int a = 0; a < plan.approachCount; a++){
+                redSince[a] = now;
+            }
+            wasGreen = frame.green;
+            started = true;
+        }
+        uint8_t turnedGreen = frame.green & ~wasGreen;
+        uint8_t turnedRed = wasGreen & ~frame.green;
+        wasGreen = frame.green;
+
+        for(int a = 0; a < plan.approachCount; a++){
+            if(turnedRed & bit(a)){
+                redSince[a] = now;
+            }
+            if(turnedGreen & bit(a)){
+                // The first vehicle away carries the start-up delay, so only time the ones after it
+                timingDepartures &= ~bit(a);
+            }
+            int departed = frame.departures[a];
+            if(!departed){
+                continue;
+            }
+            windowDepartures[a] += departed;
+            if(frame.green & bit(a)){
+                // Vehicles close behind each other are a queue discharging; longer gaps are just light traffic
+                if(timingDepartures & bit(a)){
+                    float gap = frame.departureInterval[a] / 1000000.0f;
+                    if(gap < 2 * headway[a]){
+                        headway[a] += (gap - headway[a]) / 8;
+                        headway[a] = headway[a] < 1 ? 1 : (headway[a] > 6 ? 6 : headway[a]);
+                    }
+                }
+                timingDepartures |= bit(a);
+            }
+        }
+    }
+
+    // Recalculate the green times from the flows since the last call. Call once a
+    // cycle, with the frame's uptime. Returns false if too little time has passed to say anything.
+    bool retime(uint64_t now){
+        float window = seconds(windowStart, now);
+        if(!started || window < 1){
+            return false;
+        }
+        for(int a = 0; a < plan.approachCount; a++){
+            float latest = windowDepartures[a] / window;
+            flow[a] = measured ? flow[a] + (latest - flow[a]) / 4 : latest;
+            windowDepartures[a] = 0;
+        }
+        windowStart = now;
+        measured = true;
+
+        float lost = plan.phaseCount * settings.lostTime;
+        float total = 0; // Y, the intersection's flow ratio
+        for(int p = 0; p < plan.phaseCount; p++){
+            total += flowRatio(p);
+        }
+        // Y near 1 means demand is at capacity; hold it short of the formula's asymptote
+        float saturation = total > 0.9f ? 0.9f : total;
+        cycle = (1.5f * lost + 5) / (1 - saturation);
+        float shortest = lost + plan.phaseCount * settings.minGreen;
+        cycle = cycle < shortest ? shortest : (cycle > settings.maxCycle ? settings.maxCycle : cycle);
+
+        for(int p = 0; p < plan.phaseCount; p++){
+            greens[p] = clampGreen(total > 0 ? (cycle - lost) * flowRatio(p) / total : settings.minGreen);
+        }
+        return true;
+    }
+
+    // True once a cycle's traffic has been measured. Until then the controller
+    // keeps its configured vehicle limits.
+    bool hasMeasured(){
+        return measured;
+    }
+
+    // How long 'phase' holds its green once another approach is waiting.
+    float greenTime(int phase){
+        return greens[phase];
+    }
+
+    // Vehicles 'approach' may let through while others wait: its share of the
+    // green, or more if a long red has built a longer queue than that.
+    int vehicleLimit(int approach, int phase, uint64_t now){
+        int limit = (int)(greens[phase] / headway[approach] + 0.5f);
+        int queue = (int)(queueEstimate(approach, now) + 0.5f);
+        int longest = (int)(settings.maxGreen / headway[approach]);
+        if(queue > limit){
+            limit = queue < longest ? queue : longest;
+        }
+        return limit < 1 ? 1 : limit;
+    }
+
+    // Estimated vehicles queued on a red approach.
+    float queueEstimate(int approach, uint64_t now){
+        if(wasGreen & bit(approach)){
+            return 0;
+        }
+        return flow[approach] * seconds(redSince[approach], now);
+    }
+
+    const OptimizerSettings& limits(){
+        return settings;
+    }
+
+    float arrivalRate(int approach){
+        return flow[approach];
+    }
+
+    float saturationHeadway(int approach){
+        return headway[approach];
+    }
+
+    float cycleLength(){
+        return cycle;
+    }
+};
+
+#endif
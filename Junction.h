@@ -0,0 +1,140 @@
+#ifndef JUNCTION_H
+#define JUNCTION_H
+
+#include "mbed.h"
+#include "TL_Sensor.h"
+#include "TL_Signal.h"
+#include "Telemetry.h"
+
+const int JUNCTION_NAME_LENGTH = 16; // Including the terminator; longer names are cut short
+
+//Class for the entire Junction
+class Junction{
+    private:
+    /*Do not allow the hardware to be directly accessible in main.*/
+    TL_Sensor sensor; //Instance of the Presence sensor object
+    TL_Signal signal; //Instance of the Traffic Light Signals object
+
+    char junctionName[JUNCTION_NAME_LENGTH]; //Name of the Junction, used for monitoring
+    Telemetry* telemetry; // Where status reports go
+    uint16_t departuresSeen; // Sensor departure count when last taken (for counting vehicles)
+
+    public:
+     
+    int surplusVehicleLimit; // Max vehicle count (while other junction waiting)
+    bool changeTriggered; // Flag variable for triggering junction without vehicle waiting.
+    bool vehicleCounterStarted; // Flag for enabling/disabling vehicle counting.
+    int surplusVehicleCount; // Current vehicle count (while other junction waiting)
+    bool remoteTrigger; // Allows for bluetooth override
+
+
+    //Constructor
+    Junction(const char* _junctionName, DigitalOut* _irEmitter, AnalogIn* _irReceiver, DigitalOut* _indicatorLamp, float _sensitivity, DigitalOut* _redLight, DigitalOut* _greenLight, int _surplusVehicleLimit, Telemetry* _telemetry)
+        : sensor(_irEmitter, _irReceiver, _indicatorLamp, _sensitivity)
+        , signal(_redLight,_greenLight)
+        , telemetry(_telemetry)
+        , surplusVehicleLimit(_surplusVehicleLimit){
+            // Set initial values
+            strncpy(junctionName, _junctionName, JUNCTION_NAME_LENGTH - 1);
+            junctionName[JUNCTION_NAME_LENGTH - 1] = '\0';
+            changeTriggered = false;
+            vehicleCounterStarted = false;
+            departuresSeen = 0;
+            surplusVehicleCount = 0;
+            remoteTrigger = false;
+    }
+
+    // Called from the sampling interrupt. Returns true if the sensor changed state.
+    bool sampleSensor(){
+        return sensor.sample();
+    }
+
+    // Low power: one pulse of the sensor's emitter instead of sampleSensor()
+    // (see TL_Sensor::startPulse). finishPulse() returns true if the sensor changed state.
+    void startPulse(){
+        sensor.startPulse();
+    }
+
+    bool finishPulse(){
+        return sensor.finishPulse();
+    }
+
+    // Time the sensor's emitter has been lit since power up, in microseconds
+    uint64_t emitterOnTime(){
+        return sensor.emitterOnTime();
+    }
+
+    // Name used in status reports
+    const char* name(){
+        return junctionName;
+    }
+
+    // Accessible method to check state of Junction
+    bool isGreen(){
+        return signal.isGreen;
+    }
+
+    // Is a vehicle at the presence sensor right now
+    bool isVehicleWaiting(){
+        return sensor.checkForVehicle();
+    }
+
+    // Vehicles counted since power up (wraps at 65536).
+    uint16_t vehiclesCounted(){
+        return sensor.departureCount();
+    }
+
+    // Vehicles that have left the sensor since this was last called.
+    int takeDepartures(){
+        uint16_t total = sensor.departureCount();
+        int departed = (uint16_t)(total - departuresSeen);
+        departuresSeen = total;
+        return departed;
+    }
+
+    //Count vehicles gone through the junction
+    void countDepartures(int vehicles){
+        for(int i = 0; i < vehicles; i++){
+            surplusVehicleCount++;
+            if(isGreen()){
+               if(vehicleCounterStarted){
+                telemetry->log(MSG_VEHICLES_LEFT, junctionName, surplusVehicleLimit - surplusVehicleCount);
+                } 
+            }
+        }
+    }
+    void changeRed(){
+        if(signal.isGreen){
+            signal.turnRed();
+            telemetry->log(MSG_TURNED_RED, junctionName);
+        }
+        
+    }
+    void changeGreen(){
+        if(!signal.isGreen){
+            signal.turnGreen();
+            telemetry->log(MSG_TURNED_GREEN, junctionName);
+        }   
+    }
+    
+    // Vehicle counter used when a vehicle is waiting at another junction
+    void startVehicleCounter(){
+            vehicleCounterStarted = true;
+            surplusVehicleCount = 0;
+    }
+    void stopVehicleCounter(){
+        vehicleCounterStarted = false;
+    }
+
+
+    // Ambient IR level the sensor is currently correcting for, in hundredths
+    int32_t ambientLevel(){
+        return (int32_t)(sensor.ambient() * 100 + 0.5f);
+    }
+
+    void ReportSensor(){
+        telemetry->log(MSG_CALIBRATION, junctionName, ambientLevel());
+    }
+};
+
+#endif
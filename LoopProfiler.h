@@ -0,0 +1,282 @@
+#ifndef LOOPPROFILER_H
+#define LOOPPROFILER_H
+
+#include "mbed.h"
+#include "Scheduler.h"
+#include "TelemetryBlock.h"
+#include <stdarg.h>
+#include <string.h>
+#ifdef TL_HOST_SIM
+#include <chrono>
+#endif
+
+// The parts of the firmware that are timed. The first two are interrupts; the
+// rest are parts of the main loop's pass, which they can preempt (and so lengthen).
+enum ProfileStage {
+    STAGE_SAMPLING, // Sensor ticker interrupt
+    STAGE_TELEMETRY, // Telemetry TX interrupt, formatting lines for the UART
+    STAGE_COMMANDS, // The comms task, decoding remote frames
+    STAGE_SENSING, // Taking the sensor frame, counting and the optimizer (part of STAGE_CONTROL)
+    STAGE_CONTROL, // Controller::update(): the signals and the crossing
+    STAGE_DEADLINES, // Arming the wake-up for the next timer
+    STAGE_PASS, // From waking to going back to sleep, every task that ran
+    STAGE_COUNT
+};
+
+// Intervals that are timed, to show how regularly things happen.
+enum ProfilePeriod {
+    PERIOD_SAMPLING, // Between sensor samples, nominally the PowerManager's sampling period
+    PERIOD_WAKE, // Between main loop passes
+    PERIOD_COUNT
+};
+
+// Histogram buckets, in microseconds: <1, <2, <4, ... <1024, and the rest
+const int PROFILE_BUCKETS = 12;
+
+// Free running cycle counter: the core's DWT CYCCNT on the LPC1768. In the
+// simulator it times the host CPU instead: the time stamp counter on x86, which
+// is cheap enough to leave on, or the steady clock in nanoseconds elsewhere.
+#ifdef TL_HOST_SIM
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+inline uint32_t profileTicks(){ return (uint32_t)__rdtsc(); }
+#else
+inline uint32_t profileTicks(){
+    return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#endif
+inline void profileClockStart(){}
+// Measured against the steady clock, as the TSC rate isn't published
+inline uint32_t profileCalibrate(){
+    std::chrono::steady_clock::time_point from = std::chrono::steady_clock::now();
+    uint32_t start = profileTicks();
+    while(std::chrono::steady_clock::now() - from < std::chrono::milliseconds(2)){}
+    uint32_t ticks = profileTicks() - start;
+    uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - from).count();
+    uint32_t perUs = us ? (uint32_t)(ticks / us) : 1;
+    return perUs ? perUs : 1;
+}
+// Once per process, however many simulated sites share it
+inline uint32_t profileTicksPerUs(){
+    static const uint32_t perUs = profileCalibrate();
+    return perUs;
+}
+#else
+inline void profileClockStart(){
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+inline uint32_t profileTicks(){ return DWT->CYCCNT; }
+inline uint32_t profileTicksPerUs(){ return SystemCoreClock / 1000000; }
+#endif
+
+// Times each stage of the firmware with the cycle counter, and the periods
+// between sensor samples and loop passes with the microsecond ticker, keeping
+// count, min, average, max and a histogram of each. Recording a time is a
+// subtraction, a divide and a few adds, so it stays on in the field; the
+// report is only put together when it is asked for, and sent as a block of
+// text after a telemetry line (see Telemetry::logBlock).
+class LoopProfiler : public TelemetryBlock {
+    private:
+    struct Stats {
+        uint32_t count;
+        uint32_t min;
+        uint32_t max;
+        uint64_t total;
+        uint32_t histogram[PROFILE_BUCKETS];
+    };
+
+    // Stages in cycle counter ticks, periods in microseconds. The interrupts
+    // update theirs as they go; the main loop copies them with interrupts off.
+    Stats stages[STAGE_COUNT];
+    Stats periods[PERIOD_COUNT];
+    uint32_t lastTick[PERIOD_COUNT]; // us_ticker_read() at the last tick(), 0 before the first
+    uint32_t nominal[PERIOD_COUNT]; // Expected period; the histogram is of the jitter from it
+    uint32_t ticksPerUs;
+    Scheduler* scheduler; // Time since power up, for the length of the report
+    uint64_t since; // Microseconds since power up at the last reset
+
+    // Report being read out by the TX interrupt
+    char* report;
+    const unsigned reportSize;
+    unsigned reportLength;
+    unsigned reportPosition;
+    volatile bool sending;
+
+    static void clear(Stats& stats){
+        stats.count = 0;
+        stats.min = 0xFFFFFFFF;
+        stats.max = 0;
+        stats.total = 0;
+        for(int b = 0; b < PROFILE_BUCKETS; b++){
+            stats.histogram[b] = 0;
+        }
+    }
+
+    static void add(Stats& stats, uint32_t value, uint32_t us){
+        stats.count++;
+        stats.total += value;
+        if(value < stats.min){
+            stats.min = value;
+        }
+        if(value > stats.max){
+            stats.max = value;
+        }
+        int bucket = us ? 32 - __CLZ(us) : 0;
+        stats.histogram[bucket < PROFILE_BUCKETS ? bucket : PROFILE_BUCKETS - 1]++;
+    }
+
+    void print(const char* format, ...){
+        va_list args;
+        va_start(args, format);
+        int length = vsnprintf(report + reportLength, reportSize - reportLength, format, args);
+        va_end(args);
+        if(length > 0){
+            reportLength += length;
+        }
+        if(reportLength >= reportSize){
+            reportLength = reportSize - 1; // Cut short
+        }
+    }
+
+    // One line of the report. 'scale' turns the stats into hundredths of a microsecond.
+    void printStats(const char* name, const Stats& stats, uint32_t scale, uint32_t divisor){
+        uint32_t min = stats.count ? (uint32_t)((uint64_t)stats.min * scale / divisor) : 0;
+        uint32_t avg = stats.count ? (uint32_t)(stats.total * scale / divisor / stats.count) : 0;
+        uint32_t max = (uint32_t)((uint64_t)stats.max * scale / divisor);
+        print("%-11s%9lu%9lu.%02lu%9lu.%02lu%9lu.%02lu ", name, (unsigned long)stats.count,
+              (unsigned long)(min / 100), (unsigned long)(min % 100),
+              (unsigned long)(avg / 100), (unsigned long)(avg % 100),
+              (unsigned long)(max / 100), (unsigned long)(max % 100));
+        for(int b = 0; b < PROFILE_BUCKETS; b++){
+            print(" %lu", (unsigned long)stats.histogram[b]);
+        }
+        print("\n");
+    }
+
+    public:
+    // 'buffer' holds the report while it is sent; 1.5KB fits every line.
+    LoopProfiler(char* buffer, unsigned size, Scheduler* _scheduler)
+    : ticksPerUs(1)
+    , scheduler(_scheduler)
+    , since(0)
+    , report(buffer)
+    , reportSize(size)
+    , reportLength(0)
+    , reportPosition(0)
+    , sending(false) {
+        nominal[PERIOD_SAMPLING] = 1000;
+        nominal[PERIOD_WAKE] = 0;
+        reset();
+    }
+
+    // Start the cycle counter. Call from main(), once the clocks are set up.
+    void start(){
+        profileClockStart();
+        ticksPerUs = profileTicksPerUs();
+        reset();
+    }
+
+    // Forget everything timed so far. Main loop.
+    void reset(){
+        __disable_irq();
+        for(int s = 0; s < STAGE_COUNT; s++){
+            clear(stages[s]);
+        }
+        for(int p = 0; p < PERIOD_COUNT; p++){
+            clear(periods[p]);
+            lastTick[p] = 0;
+        }
+        since = scheduler->sincePowerUp();
+        __enable_irq();
+    }
+
+    // Time a stage: take begin() as it starts and pass it to end() as it finishes.
+    uint32_t begin(){
+        return profileTicks();
+    }
+
+    void end(ProfileStage stage, uint32_t began){
+        uint32_t ticks = profileTicks() - began;
+        add(stages[stage], ticks, ticks / ticksPerUs);
+    }
+
+    // The period 'period' is expected to have from now on. The interval across
+    // the change is left out.
+    void setNominal(ProfilePeriod period, uint32_t us){
+        __disable_irq();
+        nominal[period] = us;
+        lastTick[period] = 0;
+        __enable_irq();
+    }
+
+    // Mark one occurrence of a periodic event.
+    void tick(ProfilePeriod period){
+        uint32_t now = us_ticker_read();
+        if(lastTick[period]){
+            uint32_t interval = now - lastTick[period];
+            uint32_t jitter = interval > nominal[period] ? interval - nominal[period] : nominal[period] - interval;
+            add(periods[period], interval, jitter);
+        }
+        lastTick[period] = now ? now : 1;
+    }
+
+    // Put the report together, to send as a block. Returns its length in
+    // bytes, or 0 if the last one is still going out.
+    unsigned startReport(){
+        if(sending){
+            return 0;
+        }
+        Stats stageCopy[STAGE_COUNT];
+        Stats periodCopy[PERIOD_COUNT];
+        __disable_irq();
+        memcpy(stageCopy, stages, sizeof(stages));
+        memcpy(periodCopy, periods, sizeof(periods));
+        uint64_t elapsed = scheduler->sincePowerUp() - since;
+        uint32_t sampling = nominal[PERIOD_SAMPLING];
+        __enable_irq();
+
+        static const char* const stageNames[STAGE_COUNT] = {
+            "Sampling", "Telemetry", "Commands", "Sensing", "Control", "Deadlines", "Pass"
+        };
+        static const char* const periodNames[PERIOD_COUNT] = {
+            "Sample gap", "Wake gap"
+        };
+        reportLength = 0;
+        print("Over %lu.%03lu s, us: count min avg max, then histogram <1 <2 <4 .. <1024 more\n",
+              (unsigned long)(elapsed / 1000000), (unsigned long)(elapsed / 1000 % 1000));
+        for(int s = 0; s < STAGE_COUNT; s++){
+            printStats(stageNames[s], stageCopy[s], 100, ticksPerUs);
+        }
+        print("Periods, histogram of the jitter from nominal (sampling %lu us)\n", (unsigned long)sampling);
+        for(int p = 0; p < PERIOD_COUNT; p++){
+            printStats(periodNames[p], periodCopy[p], 100, 1);
+        }
+        reportPosition = 0;
+        __DMB();
+        sending = true;
+        return reportLength;
+    }
+
+    // Give up on a report that startReport() set up but that never got sent.
+    void cancelReport(){
+        sending = false;
+    }
+
+    // TX interrupt: the next byte of the report, false once it has all gone.
+    bool nextByte(uint8_t& byte){
+        if(!sending){
+            return false;
+        }
+        byte = (uint8_t)report[reportPosition];
+        if(++reportPosition == reportLength){
+            __DMB();
+            sending = false;
+        }
+        return true;
+    }
+};
+
+#endif
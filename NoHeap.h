@@ -0,0 +1,63 @@
+#ifndef NOHEAP_H
+#define NOHEAP_H
+
+// The controller runs without a heap: every object is sized at build time, so
+// nothing can fail to allocate, fragment or stall in the allocator after weeks
+// in the field. Include this in exactly one source file (main.cpp) to have the
+// link fail if anything brings the heap in after all.
+//
+// GCC: these stand in for malloc() and friends and operator new, and each
+// calls a function that does not exist. The build uses -ffunction-sections and
+// --gc-sections, so while nothing calls them they are thrown away unread. Once
+// something does, they are kept, and the link stops with "undefined reference
+// to heap_used_see_NoHeap_h" from the function that needed it.
+//
+// newlib's own allocator, _malloc_r() and friends, is left alone: stdio is an
+// accepted exception. The firmware formats text with snprintf() and
+// vsnprintf() (Telemetry::format, LoopProfiler::print), and newlib's string
+// output refers to _malloc_r() and _realloc_r() for growing a buffer it owns,
+// so the allocator is always linked in. Into a caller's buffer, as here, it is
+// never called; nor is it for integer conversions (no floats are formatted).
+// The one stdio path that does allocate is mbed's error(), which buffers stderr
+// on the way to halting the board. Anything else that calls the C library's
+// allocator by name, or new, still fails the link.
+//
+// Arm Compiler (the mbed online compiler): no check. The C library's own,
+// __use_no_heap, rejects stdio file I/O as well, and mbed's error() writes to
+// stderr, so it would fail every link. Build with GCC to check.
+//
+// Target builds only; the simulator has a heap of its own.
+#if !defined(TL_HOST_SIM) && defined(__GNUC__) && !defined(__ARMCC_VERSION)
+
+#include <stddef.h>
+#include <new>
+
+extern "C" {
+
+void heap_used_see_NoHeap_h(void) __attribute__((noreturn)); // Deliberately never defined
+
+void* malloc(size_t){
+    heap_used_see_NoHeap_h();
+}
+
+void* calloc(size_t, size_t){
+    heap_used_see_NoHeap_h();
+}
+
+void* realloc(void*, size_t){
+    heap_used_see_NoHeap_h();
+}
+
+}
+
+void* operator new(size_t){
+    heap_used_see_NoHeap_h();
+}
+
+void* operator new[](size_t){
+    heap_used_see_NoHeap_h();
+}
+
+#endif
+
+#endif
@@ -0,0 +1,146 @@
+#ifndef PEDESTRIANCROSSING_H
+#define PEDESTRIANCROSSING_H
+
+#include "mbed.h"
+#include "Scheduler.h"
+#include "SegmentDisplay.h"
+#include "Telemetry.h"
+
+// Steps of the pedestrian crossing sequence
+enum PedPhase {
+    PED_STOP, // Red, traffic running
+    PED_WALK, // Green, counting down on the 7 segment display
+    PED_CLEARANCE // Red again, holding traffic while the crossing clears
+};
+
+class PedestrianCrossing {
+    private:
+    DigitalOut* Red_Light;
+    DigitalOut* Green_Light;
+    SegmentDisplay* display; // Countdown display
+    Telemetry* telemetry; // Where status reports go
+    bool isGreen;
+    PedPhase phase; // Where the crossing sequence is up to
+    int countdown; // Number currently on the 7 segment display
+    const float countdownStep; // Seconds each countdown digit is shown
+    const float clearanceTime; // Seconds of all red after the crossing, before traffic moves
+
+    // Start a countdown to warn pedestrian of time left to cross.
+    void startCountdown(){
+        telemetry->log(MSG_PED_COUNTDOWN);
+        countdown = 9;
+        display->showNumber(countdown);
+        phase = PED_WALK;
+        phaseTimer.reset();
+        phaseTimer.start();
+    }
+
+    public:
+    DeadlineTimer waitingTimer;
+    DeadlineTimer phaseTimer; // Time spent in the current phase of the crossing
+    bool remoteTrigger;
+
+    PedestrianCrossing(DigitalOut* _pedRedLight, DigitalOut* _pedGreenLight, SegmentDisplay* _display, Telemetry* _telemetry, float _countdownStep, float _clearanceTime)
+    : Red_Light(_pedRedLight)
+    , Green_Light(_pedGreenLight)
+    , display(_display)
+    , telemetry(_telemetry)
+    , countdownStep(_countdownStep)
+    , clearanceTime(_clearanceTime){
+        isGreen = false;
+        remoteTrigger = false;
+        phase = PED_STOP;
+        countdown = 0;
+    }
+
+    // True from the moment the crossing turns green until the clearance time has passed.
+    bool isActive(){
+        return phase != PED_STOP;
+    }
+
+    // Step the crossing sequence along; call on every pass. Returns true on the
+    // pass where the clearance time has run out and traffic may move again.
+    bool update(){
+        switch(phase){
+            case PED_WALK: {
+                // Work the digit out from the elapsed time, so late passes never stretch the countdown
+                int shown = 9 - (int)(phaseTimer.read() / countdownStep);
+                if(shown < 0){
+                    display->clear();
+                    changeRed();
+                    phase = PED_CLEARANCE;
+                    phaseTimer.reset();
+                } else if(shown != countdown){
+                    countdown = shown;
+                    display->showNumber(countdown);
+                }
+                return false;
+            }
+            case PED_CLEARANCE:
+                if(phaseTimer.read() > clearanceTime){
+                    phaseTimer.stop();
+                    phaseTimer.reset();
+                    phase = PED_STOP;
+                    return true;
+                }
+                return false;
+            default:
+                return false;
+        }
+    }
+
+    // Emergency stop: end the crossing straight away, whatever step it is on.
+    void abort(){
+        if(phase == PED_STOP){
+            return;
+        }
+        if(isGreen){
+            changeRed();
+        }
+        display->clear();
+        phaseTimer.stop();
+        phaseTimer.reset();
+        phase = PED_STOP;
+    }
+
+    // Put a status or fault code on the countdown display while the crossing
+    // is idle, e.g. during an emergency stop. An empty code clears it.
+    void showStatus(const char* code){
+        if(phase == PED_STOP){
+            display->showText(code);
+        }
+    }
+
+    // How long a crossing takes, from the green man to traffic moving again.
+    float duration(){
+        return 10 * countdownStep + clearanceTime;
+    }
+
+    // When the current phase next needs update(), in seconds on phaseTimer.
+    float phaseLimit(){
+        return phase == PED_WALK ? (10 - countdown) * countdownStep : clearanceTime;
+    }
+
+    // Have pedestrians wait a certain amount of time before changing the lights
+    void StartWaitingTimer(){
+        waitingTimer.start();
+    }
+
+    void changeGreen(){
+        *Red_Light = 0;
+        *Green_Light = 1;
+        isGreen = true;
+        telemetry->log(MSG_PED_GREEN);
+        startCountdown(); // Runs on from update(), then turns red
+    }
+    void changeRed(){
+        *Green_Light = 0;
+        *Red_Light = 1;
+        isGreen = false;
+        waitingTimer.stop();
+        waitingTimer.reset();
+        telemetry->log(MSG_PED_RED);
+    }
+};
+
+#endif
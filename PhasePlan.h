@@ -0,0 +1,55 @@
+#ifndef PHASEPLAN_H
+#define PHASEPLAN_H
+
+#include "mbed.h"
+
+// Approaches are numbered from 0 and handled as bits of a uint8_t, so a whole
+// phase plan is a few bytes and checking a phase against the sensors is one AND.
+const int MAX_APPROACHES = 8;
+const int MAX_PHASES = 8;
+const int NO_PHASE = -1;
+
+// Run-time view of a phase plan, as walked by the Controller.
+struct PhasePlan {
+    const uint8_t* conflicts; // conflicts[a]: approaches that must be red while approach a is green
+    const uint8_t* phases; // phases[p]: approaches that are green together in phase p
+    uint8_t approachCount;
+    uint8_t phaseCount;
+    uint8_t defaultPhase; // Phase the intersection rests in, and reverts to when idle
+};
+
+// Phase plan for a site with a fixed number of approaches. Declare it constexpr
+// so it is built at compile time, lives in flash, and can be checked with
+//     static_assert(sitePlan.isSafe(), "...");
+// before it ever reaches a board.
+template<unsigned Approaches, unsigned Phases>
+struct FixedPhasePlan {
+    uint8_t conflicts[Approaches];
+    uint8_t phases[Phases];
+    uint8_t defaultPhase;
+
+    // Conflicts are mutual, and no phase turns two conflicting approaches green.
+    constexpr bool isSafe() const {
+        return Approaches <= MAX_APPROACHES && Phases <= MAX_PHASES && defaultPhase < Phases && mutualFrom(0, 0) && phasesSafeFrom(0);
+    }
+
+    PhasePlan plan() const {
+        PhasePlan view = { conflicts, phases, (uint8_t)Approaches, (uint8_t)Phases, defaultPhase };
+        return view;
+    }
+
+    // Helpers for isSafe(), written as recursion for C++11 constexpr.
+    constexpr bool mutualFrom(unsigned a, unsigned b) const {
+        return a >= Approaches ? true
+             : b >= Approaches ? mutualFrom(a + 1, 0)
+             : (!((conflicts[a] >> b) & 1) || ((conflicts[b] >> a) & 1)) && mutualFrom(a, b + 1);
+    }
+    constexpr bool phaseSafeFrom(uint8_t green, unsigned a) const {
+        return a >= Approaches || ((!((green >> a) & 1) || !(conflicts[a] & green)) && phaseSafeFrom(green, a + 1));
+    }
+    constexpr bool phasesSafeFrom(unsigned p) const {
+        return p >= Phases || (phaseSafeFrom(phases[p], 0) && phasesSafeFrom(p + 1));
+    }
+};
+
+#endif
@@ -0,0 +1,155 @@
+#ifndef POWERMANAGER_H
+#define POWERMANAGER_H
+
+#include "mbed.h"
+#include "Controller.h"
+#include "LoopProfiler.h"
+#include "PhasePlan.h"
+#include "Scheduler.h"
+#include "Telemetry.h"
+
+// Supply currents the draw is estimated from. Rough figures for the bare
+// board; measure a site's own to refine them. The signal lamps are not included.
+struct PowerModel {
+    float volts;
+    float runMilliamps; // Core awake
+    float sleepMilliamps; // Core asleep, with the peripherals still clocked
+    float emitterMilliamps; // One IR emitter, while lit
+};
+
+const uint32_t SAMPLE_PERIOD_FULL = 1000; // Microseconds between sensor samples
+const uint32_t SAMPLE_PERIOD_IDLE = 20000; // The same in low power mode, while every approach is empty
+const float IDLE_AFTER = 5; // Seconds every approach must be empty before sampling slows
+
+// Low power mode, for solar and battery sites. Each sensor sample pulses the
+// emitters, together, for the one lit reading instead of lighting them every
+// other tick (see TL_Sensor::startPulse), and once every approach has been
+// empty for a while the sensors are sampled at the idle rate, so between
+// samples the core sleeps and the emitters are dark. The pass that sees the
+// first detection puts the full rate back; a vehicle is seen at the idle rate
+// within a few samples.
+//
+// The core only ever sleeps, never deep sleeps: on the LPC1768 deep sleep
+// stops the timer the tickers and deadlines run from. The conflict monitor
+// still checks every millisecond, so idling saves the sampling work and the
+// emitters' current rather than wake-ups.
+//
+// Either way it measures where the power goes: the time the core spends awake
+// (from the Scheduler) and each emitter's lit time, since the last report.
+class PowerManager {
+    private:
+    Ticker* ticker; // Sensor sampling
+    Scheduler* scheduler;
+    Telemetry* telemetry;
+    PowerModel model;
+    LoopProfiler* profiler; // May be NULL; told the sampling period
+    Controller* controller; // Set by start()
+    bool lowPower;
+    bool idle; // Sampling at the idle rate
+    Timer quiet; // Since an approach was last occupied
+
+    // At the start of the measurement
+    uint64_t awakeAtStart;
+    uint64_t asleepAtStart;
+    uint32_t wakesAtStart;
+    uint64_t emitterAtStart[MAX_APPROACHES];
+
+    void sampleEvery(uint32_t period){
+        ticker->attach_us(callback(controller, &Controller::sampleSensors), period);
+        if(profiler){
+            profiler->setNominal(PERIOD_SAMPLING, period);
+        }
+    }
+
+    void startMeasuring(){
+        awakeAtStart = scheduler->awakeTime();
+        asleepAtStart = scheduler->asleepTime();
+        wakesAtStart = scheduler->wakeCount();
+        for(int a = 0; a < controller->approachCount(); a++){
+            emitterAtStart[a] = controller->approach(a).emitterOnTime();
+        }
+    }
+
+    static int32_t hundredthsOfPercent(uint64_t part, uint64_t whole){
+        return whole ? (int32_t)(part * 10000 / whole) : 0;
+    }
+
+    public:
+    PowerManager(Ticker* _ticker, Scheduler* _scheduler, Telemetry* _telemetry, PowerModel _model, LoopProfiler* _profiler = NULL)
+    : ticker(_ticker)
+    , scheduler(_scheduler)
+    , telemetry(_telemetry)
+    , model(_model)
+    , profiler(_profiler)
+    , controller(NULL)
+    , lowPower(false)
+    , idle(false)
+    , awakeAtStart(0)
+    , asleepAtStart(0)
+    , wakesAtStart(0) {}
+
+    // Start sampling the controller's sensors, at the full rate.
+    void start(Controller* _controller, bool _lowPower){
+        controller = _controller;
+        quiet.start();
+        setLowPower(_lowPower);
+        sampleEvery(SAMPLE_PERIOD_FULL);
+        startMeasuring();
+    }
+
+    void setLowPower(bool on){
+        lowPower = on;
+        controller->setPulsedSensing(on);
+        if(!on && idle){
+            idle = false;
+            sampleEvery(SAMPLE_PERIOD_FULL);
+        }
+        quiet.reset();
+    }
+
+    bool isIdle(){
+        return idle;
+    }
+
+    // After each control pass, before the deadlines are armed: back to the full
+    // rate as soon as an approach is occupied, or down to the idle rate once
+    // they have all been empty long enough (waking for it if need be).
+    void update(){
+        if(controller->lastFrame().present){
+            quiet.reset();
+            if(idle){
+                idle = false;
+                sampleEvery(SAMPLE_PERIOD_FULL);
+            }
+        } else if(lowPower && !idle){
+            if(quiet.read() >= IDLE_AFTER){
+                idle = true;
+                sampleEvery(SAMPLE_PERIOD_IDLE);
+            } else {
+                scheduler->watchIn(IDLE_AFTER - quiet.read());
+            }
+        }
+    }
+
+    // Duty cycles since the last report, and the draw they come to.
+    void report(){
+        uint64_t awake = scheduler->awakeTime() - awakeAtStart;
+        uint64_t elapsed = awake + scheduler->asleepTime() - asleepAtStart;
+        telemetry->log(MSG_COUNTER, "Low power", lowPower);
+        telemetry->log(MSG_COUNTER, "Seconds measured", (int32_t)(elapsed / 1000000));
+        telemetry->log(MSG_COUNTER, "Wakes per second", elapsed ? (int32_t)((uint64_t)(scheduler->wakeCount() - wakesAtStart) * 1000000 / elapsed) : 0);
+
+        int32_t awakeShare = hundredthsOfPercent(awake, elapsed);
+        telemetry->log(MSG_AWAKE, 0, awakeShare);
+        float milliamps = (model.runMilliamps * awakeShare + model.sleepMilliamps * (10000 - awakeShare)) / 10000;
+        for(int a = 0; a < controller->approachCount(); a++){
+            int32_t litShare = hundredthsOfPercent(controller->approach(a).emitterOnTime() - emitterAtStart[a], elapsed);
+            telemetry->log(MSG_EMITTER_DUTY, controller->approach(a).name(), litShare);
+            milliamps += model.emitterMilliamps * litShare / 10000;
+        }
+        telemetry->log(MSG_POWER_DRAW, 0, (int32_t)(milliamps * model.volts + 0.5f));
+        startMeasuring();
+    }
+};
+
+#endif
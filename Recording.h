@@ -0,0 +1,78 @@
+#ifndef RECORDING_H
+#define RECORDING_H
+
+#include <stdint.h>
+
+// Layout of the traffic recording kept by TrafficRecorder and pulled off a
+// site with the dump command. Shared with the host tools, so it only needs
+// <stdint.h>. Everything is little-endian: a RecordingHeader followed by
+// 'count' Records. A dump can start anywhere in a capture, so copy the header
+// out before reading it; Records are bytes and can be read in place.
+//
+// Each Record is four bytes:
+//   0-1  milliseconds since the previous record
+//   2    kind << 3 | index   (index: the approach or phase it concerns)
+//   3    value
+// A gap of more than 65535 ms is carried by REC_TIME records in front, and a
+// value over 255 by a REC_VALUE_HIGH record in front holding its high byte.
+
+const char RECORDING_MAGIC[4] = { 'T', 'L', 'R', 'C' };
+const uint8_t RECORDING_VERSION = 2;
+
+enum RecordKind {
+    REC_TIME = 0, // No event: value << 16 | delta milliseconds passed
+    REC_DEPARTURE, // index: approach, value: tenths of a second the vehicle sat over the sensor
+    REC_CHANGE, // index: phase being changed to, the others have gone red
+    REC_PHASE, // index: phase turned green
+    REC_VEHICLE_LIMIT, // index: approach whose vehicle limit forced the change
+    REC_TIMEOUT, // Reverting to the default phase
+    REC_PED_REQUEST,
+    REC_PED_WALK,
+    REC_PED_CLEAR, // Crossing cleared, traffic moving again
+    REC_AMBIENT, // index: approach, value: ambient IR in hundredths
+    REC_GREEN_TIME, // index: phase, value: green time in seconds
+    REC_STOP, // Emergency stop
+    REC_RESUME, // index: phase resumed into
+    REC_COMMAND, // value: remote command opcode applied
+    REC_VALUE_HIGH, // No event: value << 8 | the next record's value, which is at the same time
+    REC_KIND_COUNT
+};
+
+struct RecordingHeader {
+    char magic[4]; // RECORDING_MAGIC
+    uint8_t version;
+    uint8_t recordSize; // sizeof(Record)
+    uint16_t count; // Records following the header
+    uint32_t overwritten; // Records lost to the buffer wrapping, since power up
+    uint32_t reserved; // 0; keeps startTime on an eight byte boundary
+    uint64_t startTime; // Milliseconds since power up that the first record's delta counts from
+};
+static_assert(sizeof(RecordingHeader) == 24, "RecordingHeader has padding");
+
+struct Record {
+    uint8_t delta[2];
+    uint8_t kindIndex;
+    uint8_t value;
+};
+
+inline uint32_t recordDelta(const Record& record){
+    uint32_t delta = record.delta[0] | (record.delta[1] << 8);
+    if((record.kindIndex >> 3) == REC_TIME){
+        delta |= (uint32_t)record.value << 16;
+    }
+    return delta;
+}
+
+// Largest value a record can carry, with a REC_VALUE_HIGH in front. Values
+// past it are stored as it.
+const uint32_t RECORD_VALUE_MAX = 0xFFFF;
+
+inline int recordKind(const Record& record){
+    return record.kindIndex >> 3;
+}
+
+inline int recordIndex(const Record& record){
+    return record.kindIndex & 0x07;
+}
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include "mbed.h"
+
+// Fixed-size FIFO shared between one producer and one consumer, e.g. an
+// interrupt handler and the main loop. Neither side ever blocks or disables
+// interrupts: each only moves its own index. Size must be a power of two.
+template<typename T, unsigned Size>
+class RingBuffer {
+    private:
+    T items[Size];
+    volatile unsigned head; // Next slot to write (producer only)
+    volatile unsigned tail; // Next slot to read (consumer only)
+
+    public:
+    RingBuffer() : head(0), tail(0) {}
+
+    // Returns false (and drops the item) if the buffer is full.
+    bool push(const T& item){
+        unsigned next = (head + 1) & (Size - 1);
+        if(next == tail){
+            return false;
+        }
+        items[head] = item;
+        __DMB(); // Item must land before the consumer can see the new head
+        head = next;
+        return true;
+    }
+
+    bool pop(T& item){
+        if(tail == head){
+            return false;
+        }
+        item = items[tail];
+        __DMB(); // Finish reading before the producer can reuse the slot
+        tail = (tail + 1) & (Size - 1);
+        return true;
+    }
+
+    bool empty() const { return head == tail; }
+    unsigned count() const { return (head - tail) & (Size - 1); }
+};
+
+#endif
@@ -0,0 +1,116 @@
+#ifndef SAFETYMONITOR_H
+#define SAFETYMONITOR_H
+
+#include "mbed.h"
+#include "PhasePlan.h"
+#include "Scheduler.h"
+
+// Conflict monitor. Every millisecond, from a ticker interrupt, it reads the
+// signal outputs back and checks the greens against the phase plan's conflict
+// matrix, and the green man against every green. On a conflict it drives every
+// signal and the crossing red itself, there and then, and keeps them red each
+// millisecond after until cleared; the main loop is told with EVENT_CONFLICT,
+// to log it and stop the controller.
+//
+// It shares nothing with the Controller but the pins and the plan, so it
+// catches a sequencing bug or a stray write alike, and the controller's timing
+// can be tightened without it being the only safeguard. What it reads back is
+// the MCU's own pin (DigitalOut::read(), the port's pin register), so a signal
+// line shorted at the board shows up too; a welded relay or a lamp lit by a
+// wiring fault beyond it does not. Catching those needs feedback from the
+// field side: lamp current sensing or relay contact inputs, checked here the
+// same way.
+class SafetyMonitor {
+    private:
+    DigitalOut* const* reds; // One per approach, in phase plan order
+    DigitalOut* const* greens;
+    PhasePlan plan;
+    DigitalOut* pedRed; // NULL at sites without a crossing
+    DigitalOut* pedGreen;
+    Scheduler* scheduler;
+    Ticker ticker;
+
+    volatile bool tripped;
+    volatile uint8_t litGreens; // Greens lit when it tripped
+    volatile bool litWalk; // And whether the green man was
+
+    void forceAllRed(){
+        for(int a = 0; a < plan.approachCount; a++){
+            *greens[a] = 0;
+            *reds[a] = 1;
+        }
+        if(pedGreen){
+            *pedGreen = 0;
+            *pedRed = 1;
+        }
+    }
+
+    // Ticker interrupt
+    void check(){
+        if(tripped){
+            forceAllRed(); // Whatever else has been written since
+            return;
+        }
+        uint8_t green = 0;
+        for(int a = 0; a < plan.approachCount; a++){
+            if(greens[a]->read()){
+                green |= (uint8_t)(1 << a);
+            }
+        }
+        bool conflict = false;
+        for(int a = 0; a < plan.approachCount; a++){
+            if((green >> a) & 1){
+                conflict = conflict || (plan.conflicts[a] & green);
+            }
+        }
+        bool walk = pedGreen && pedGreen->read();
+        if(walk && green){
+            conflict = true; // The crossing runs with every approach red
+        }
+        if(conflict){
+            forceAllRed();
+            litGreens = green;
+            litWalk = walk;
+            tripped = true;
+            scheduler->post(EVENT_CONFLICT);
+        }
+    }
+
+    public:
+    SafetyMonitor(DigitalOut* const* _reds, DigitalOut* const* _greens, PhasePlan _plan, DigitalOut* _pedRed, DigitalOut* _pedGreen, Scheduler* _scheduler)
+    : reds(_reds)
+    , greens(_greens)
+    , plan(_plan)
+    , pedRed(_pedRed)
+    , pedGreen(_pedGreen)
+    , scheduler(_scheduler)
+    , tripped(false)
+    , litGreens(0)
+    , litWalk(false) {}
+
+    // Start watching. Call once, as early as the outputs are set up.
+    void start(){
+        ticker.attach_us(callback(this, &SafetyMonitor::check), 1000);
+    }
+
+    bool isTripped(){
+        return tripped;
+    }
+
+    // Approaches (as bits) that were green when it tripped
+    uint8_t conflictingGreens(){
+        return litGreens;
+    }
+
+    bool walkWasLit(){
+        return litWalk;
+    }
+
+    // Let the outputs go again, for an operator's restart. If the conflict is
+    // still there it trips again on the next check.
+    void clear(){
+        tripped = false;
+    }
+};
+
+#endif
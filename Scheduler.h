@@ -0,0 +1,136 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "mbed.h"
+
+// Things that can wake the controller. Interrupt handlers post these; the main
+// loop sleeps until at least one is pending.
+enum SchedulerEvent {
+    EVENT_SENSOR = 1 << 0, // A presence sensor changed state
+    EVENT_PED_REQUEST = 1 << 1, // Pedestrian switch pressed
+    EVENT_BLUETOOTH = 1 << 2, // Bytes received from the Bluetooth adapter
+    EVENT_DEADLINE = 1 << 3, // A controller timer has reached its limit
+    EVENT_RERUN = 1 << 4, // The controller set a trigger and wants another pass
+    EVENT_CONFLICT = 1 << 5, // The conflict monitor forced all red
+    EVENT_ALL = 0xFF
+};
+
+// Timer that remembers whether it is running, so the scheduler knows which
+// deadlines are live.
+class DeadlineTimer : public Timer {
+    private:
+    bool running;
+
+    public:
+    DeadlineTimer() : running(false) {}
+
+    void start(){ Timer::start(); running = true; }
+    void stop(){ Timer::stop(); running = false; }
+    bool isRunning(){ return running; }
+};
+
+class Scheduler {
+    private:
+    volatile uint32_t pendingEvents;
+    Timeout deadlineTimeout;
+    float nextDeadline; // Earliest deadline requested during this pass, in seconds from now (<0 if none)
+    uint64_t awake; // Microseconds since power up spent awake...
+    uint64_t asleep; // ...and asleep
+    uint32_t wakes; // Times the core has woken from sleep
+    uint32_t lastChange; // us_ticker time it last went to sleep or woke
+
+    void onDeadline(){
+        post(EVENT_DEADLINE);
+    }
+
+    public:
+    Scheduler() : pendingEvents(0), nextDeadline(-1), awake(0), asleep(0), wakes(0), lastChange(0) {}
+
+    // Safe to call from interrupt handlers.
+    void post(uint32_t events){
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        pendingEvents |= events;
+        __set_PRIMASK(primask);
+    }
+
+    // Sleep until one of the requested events is pending, then claim and return
+    // them. Events outside the mask stay pending for the next caller.
+    uint32_t waitForEvent(uint32_t mask = EVENT_ALL){
+        __disable_irq();
+        while(!(pendingEvents & mask)){
+            uint32_t now = us_ticker_read();
+            awake += now - lastChange;
+            lastChange = now;
+            sleep(); // Pending interrupts still wake the core with IRQs masked
+            now = us_ticker_read();
+            asleep += now - lastChange;
+            lastChange = now;
+            wakes++;
+            __enable_irq(); // Let them run...
+            __disable_irq(); // ...then look again
+        }
+        uint32_t events = pendingEvents & mask;
+        pendingEvents &= ~events;
+        __enable_irq();
+        return events;
+    }
+
+    // Claim whatever is pending, without sleeping; 0 if nothing is.
+    uint32_t take(uint32_t mask = EVENT_ALL){
+        __disable_irq();
+        uint32_t events = pendingEvents & mask;
+        pendingEvents &= ~events;
+        __enable_irq();
+        return events;
+    }
+
+    // Time spent awake (interrupts included) and asleep since power up, in
+    // microseconds, up to when it last went to sleep or woke.
+    uint64_t awakeTime(){
+        return awake;
+    }
+
+    uint64_t asleepTime(){
+        return asleep;
+    }
+
+    uint32_t wakeCount(){
+        return wakes;
+    }
+
+    // Microseconds since power up, in 64 bits so it never wraps, of a
+    // us_ticker_read() time up to 71 minutes ago (by default, now). Main loop.
+    uint64_t sincePowerUp(uint32_t time = us_ticker_read()){
+        uint32_t now = us_ticker_read();
+        return awake + asleep + (uint32_t)(now - lastChange) - (uint32_t)(now - time);
+    }
+
+    // Ask to be woken when 'timer' passes 'limit' seconds. Call for every live
+    // timer during a pass, then armDeadline() once to set the earliest. A timer
+    // already past its limit has had its wake-up, so it is not watched again.
+    void watch(DeadlineTimer& timer, float limit){
+        if(!timer.isRunning() || timer.read() > limit){
+            return;
+        }
+        // Controller compares with '>', so wake just after the limit.
+        watchIn(limit - timer.read() + 0.001f);
+    }
+
+    // Ask to be woken 'seconds' from now, for deadlines not kept on a timer.
+    void watchIn(float seconds){
+        if(seconds > 0 && (nextDeadline < 0 || seconds < nextDeadline)){
+            nextDeadline = seconds;
+        }
+    }
+
+    void armDeadline(){
+        deadlineTimeout.detach();
+        if(nextDeadline > 0){
+            deadlineTimeout.attach_us(callback(this, &Scheduler::onDeadline), (uint32_t)(nextDeadline * 1e6f));
+        }
+        nextDeadline = -1;
+    }
+};
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef SEGMENTDISPLAY_H
+#define SEGMENTDISPLAY_H
+
+#include "mbed.h"
+
+// Segment bits in the order the display is wired to the BusOut: (e,d,c,g,f,a,b).
+// The display is common anode, so a 0 lights a segment; bit 7 is unused and set.
+const uint8_t SEGMENT_BLANK = 0xFF;
+
+// What each character looks like, indexed by its ASCII code. Characters a
+// 7 segment display can't show (K, M, V, W, X, Z and most punctuation) are
+// blank; letters with only one usable case show that case for both.
+constexpr uint8_t SEGMENT_GLYPHS[128] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, // Control characters
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xF7, 0xFF, 0xFF, //   ! " # $ % & ' ( ) * + , - . /
+    0x88, 0xBB, 0x94, 0x91, 0xA3, 0xC1, 0xC0, 0x9B, 0x80, 0x81, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, // 0 1 2 3 4 5 6 7 8 9 : ; < = > ?
+    0xFF, 0x82, 0xE0, 0xCC, 0xB0, 0xC4, 0xC6, 0xC8, 0xA2, 0xBB, 0xD9, 0xFF, 0xEC, 0xFF, 0x8A, 0x88, // @ A B C D E F G H I J K L M N O
+    0x86, 0x83, 0xF6, 0xC1, 0xE4, 0xA8, 0xFF, 0xFF, 0xFF, 0xA1, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFD, // P Q R S T U V W X Y Z [ \ ] ^ _
+    0xFF, 0x82, 0xE0, 0xF4, 0xB0, 0xC4, 0xC6, 0x81, 0xE2, 0xDB, 0xD9, 0xFF, 0xEE, 0xFF, 0xF2, 0xF0, // ` a b c d e f g h i j k l m n o
+    0x86, 0x83, 0xF6, 0xC1, 0xE4, 0xF8, 0xFF, 0xFF, 0xFF, 0xA1, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF  // p q r s t u v w x y z { | } ~
+};
+
+// Segment pattern for a character, usable at compile time.
+constexpr uint8_t glyph(char c){
+    return SEGMENT_GLYPHS[c & 0x7F];
+}
+
+static_assert(glyph('8') == 0x80 && glyph(' ') == SEGMENT_BLANK, "Glyph table out of step with the wiring");
+
+const int MAX_DISPLAY_DIGITS = 4;
+
+// Drives a row of 7 segment digits from a BusOut. A single digit (as on the
+// bench board) is written straight out. For a multiplexed display, pass the
+// digit select lines too and call refresh() from a ticker, at least 100 times
+// a second per digit; each call lights the next digit.
+class SegmentDisplay {
+    private:
+    BusOut* segments;
+    BusOut* select; // One line per digit, active high; NULL for a single digit
+    const int digits;
+    uint8_t patterns[MAX_DISPLAY_DIGITS]; // What each digit shows, leftmost first
+    volatile int scan; // Digit refresh() lit last
+
+    void show(){
+        if(!select){
+            *segments = patterns[0];
+        }
+    }
+
+    public:
+    SegmentDisplay(BusOut* _segments, int _digits = 1, BusOut* _select = NULL)
+    : segments(_segments)
+    , select(_select)
+    , digits(_digits < 1 ? 1 : (_digits > MAX_DISPLAY_DIGITS ? MAX_DISPLAY_DIGITS : _digits))
+    , scan(0) {
+        for(int d = 0; d < MAX_DISPLAY_DIGITS; d++){
+            patterns[d] = SEGMENT_BLANK;
+        }
+    }
+
+    int width(){
+        return digits;
+    }
+
+    // Right aligned, without leading zeros. Too big to fit shows dashes.
+    void showNumber(unsigned value){
+        for(int d = digits - 1; d >= 0; d--){
+            patterns[d] = glyph((value || d == digits - 1) ? (char)('0' + value % 10) : ' ');
+            value /= 10;
+        }
+        if(value){
+            for(int d = 0; d < digits; d++){
+                patterns[d] = glyph('-');
+            }
+        }
+        show();
+    }
+
+    // Left aligned, e.g. a status or fault code; anything past the last digit is cut off.
+    void showText(const char* text){
+        for(int d = 0; d < digits; d++){
+            patterns[d] = glyph(*text);
+            text += *text != '\0';
+        }
+        show();
+    }
+
+    void clear(){
+        showText("");
+    }
+
+    // Ticker, for multiplexed displays: blank, move to the next digit, light it.
+    void refresh(){
+        if(!select){
+            return;
+        }
+        int next = scan + 1 < digits ? scan + 1 : 0;
+        *select = 0;
+        *segments = patterns[next];
+        *select = 1 << next;
+        scan = next;
+    }
+};
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef SENSORFRAME_H
+#define SENSORFRAME_H
+
+#include "mbed.h"
+#include "PhasePlan.h"
+
+// A change in a presence sensor's filtered state, stamped in the sampling
+// interrupt. Every stamp carries the same filter delay, so the times between
+// edges are exact to the sample period however late the main loop reads them.
+struct SensorEdge {
+    uint32_t time; // us_ticker_read() when the change was detected
+    uint8_t approach;
+    uint8_t arrived; // 1: vehicle arrived at the sensor, 0: it left
+};
+
+// What the controller knows about every approach for one pass. It is captured
+// once at the top of the pass and only read after that, so every decision in
+// the pass sees the same sensor state and each vehicle is counted exactly once.
+// Fields are arrays across approaches (bit masks for the flags), so a check
+// over all approaches is a single AND.
+struct SensorFrame {
+    uint32_t capturedAt; // us_ticker_read() when the frame was taken
+    uint64_t uptime; // The same, in microseconds since power up, which never wraps
+    uint8_t approachCount;
+    uint8_t present; // Vehicle at the sensor
+    uint8_t green; // Signal showing green
+    uint8_t departed; // At least one vehicle has left since the previous frame
+    uint8_t departures[MAX_APPROACHES]; // Vehicles that have left since the previous frame
+    uint8_t arrivals[MAX_APPROACHES]; // Vehicles that have arrived since the previous frame
+    // Latest measurements from the sensor edges, in microseconds (0 until measured)
+    uint32_t occupancy[MAX_APPROACHES]; // Time the last vehicle to leave spent over the sensor
+    uint32_t gap[MAX_APPROACHES]; // Time the sensor was clear before the last arrival
+    uint32_t departureInterval[MAX_APPROACHES]; // Time between the last two departures
+};
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef SITESETTINGS_H
+#define SITESETTINGS_H
+
+// The site's timings and limits as shipped: what main.cpp starts the controller
+// with, and what the host tools (sim/sweep.cpp) measure other settings against.
+// In seconds unless stated.
+const float SITE_SAFE_PASSAGE_TIME = 15; // How long the junction is green for.
+const float SITE_TRANSITION_TIME = 2; // How long all lights red between transitions
+const float SITE_PED_WAIT_LIMIT = 5; // How long a pedestrian waits before changing.
+const float SITE_TIMEOUT_TIME = 10; // How long before lights change back to default
+const int SITE_VEHICLE_LIMITS[] = { 5, 4 }; // Surplus vehicle limit per approach, Junction 1 then 2
+
+#endif
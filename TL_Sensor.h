@@ -0,0 +1,224 @@
+#ifndef TL_SENSOR_H
+#define TL_SENSOR_H
+
+#include "mbed.h"
+
+const uint32_t EMITTER_SETTLE_US = 50; // From lighting an emitter to its reading, when pulsed
+
+// Class for the Presence Sensor
+class TL_Sensor{
+    private:
+    // Define the IO, private as they should not be accessible outside of class
+    DigitalOut* irEmitter; // IR Emitter LED
+    AnalogIn* irReceiver; // IR Receiver LED
+    DigitalOut* indicator; // Indicator LED for notifying operator is object detected
+    // Levels below are ADC counts scaled to 16 bits (as read_u16), so the
+    // whole filter runs in integer arithmetic inside the sampling interrupt.
+    const int32_t onThreshold; // Reflection above the empty road that means a vehicle has arrived (Sensor Sensivitity)
+    const int32_t offThreshold; // Reflection it must drop below to count as gone
+    int32_t ambientLevel; // Ambient IR light (emitter off), with ambientShift fractional bits
+    int32_t baseline; // Reflection off the empty road, with baselineShift fractional bits
+    int32_t darkReading; // Last reading with the emitter off
+    bool emitterLit; // Emitter state for the reading about to be taken
+    uint32_t emitterOnAt; // us_ticker time the emitter was last switched on
+    uint64_t emitterMicros; // Time the emitter has been lit since power up
+    bool primed; // Set once the first dark reading has seeded the estimates
+    volatile bool vehiclePresent; // Filtered detection state, updated by sample()
+    volatile uint16_t departures; // Vehicles that have left the sensor since power up (wraps)
+    int disagreeing; // Filtered samples in a row that have disagreed with vehiclePresent
+
+    static const int burstLength = 4; // Conversions averaged into each sample
+    static const int averageLength = 8; // Median outputs in the moving average (power of two)
+    static const int32_t hysteresis = 0x3000; // Gap between the on and off thresholds (~19% of full scale, as a differential reading is noisier)
+    static const int debounce = 3; // Filtered samples in a row that must agree before the state changes
+    static const int ambientShift = 4; // Ambient estimate follows dark readings over ~16 samples
+    static const int baselineShift = 10; // Empty road baseline follows over ~1000 samples (~2s at full rate)
+
+    int32_t bursts[3]; // Last three burst averages, for the median
+    int32_t medians[averageLength]; // Last few medians, for the moving average
+    int32_t medianSum; // Running total of medians[]
+    int burstIndex;
+    int medianIndex;
+
+    // Several back to back conversions, averaged to cut the ADC's own noise.
+    int32_t readBurst(){
+        int32_t sum = 0;
+        for(int i = 0; i < burstLength; i++){
+            sum += irReceiver->read_u16();
+        }
+        return sum / burstLength;
+    }
+
+    static int32_t median3(int32_t a, int32_t b, int32_t c){
+        int32_t low = a < b ? a : b;
+        int32_t high = a < b ? b : a;
+        return c < low ? low : (c > high ? high : c);
+    }
+
+    // Median of three (drops single spikes), then a short moving average.
+    int32_t filter(int32_t value){
+        bursts[burstIndex] = value;
+        burstIndex = (burstIndex + 1) % 3;
+        int32_t median = median3(bursts[0], bursts[1], bursts[2]);
+
+        medianSum += median - medians[medianIndex];
+        medians[medianIndex] = median;
+        medianIndex = (medianIndex + 1) & (averageLength - 1);
+        return medianSum / averageLength;
+    }
+
+    // Dark reading: ambient IR alone.
+    void takeDark(int32_t reading){
+        darkReading = reading;
+        if(!primed){
+            ambientLevel = reading << ambientShift;
+            primed = true;
+        }
+        ambientLevel += reading - (ambientLevel >> ambientShift);
+    }
+
+    // Lit reading: the reflection is this less the dark reading before it.
+    bool takeLit(int32_t reading){
+        if(!primed){
+            return false;
+        }
+
+        int32_t reflection = filter(reading - darkReading);
+        int32_t level = reflection - (baseline >> baselineShift);
+
+        // Follow dirt, ageing emitters and the like only while the road is
+        // clearly empty, so a queued vehicle is never learnt as background.
+        if(!vehiclePresent && level < offThreshold / 2){
+            baseline += reflection - (baseline >> baselineShift);
+        }
+
+        bool detected = level > (vehiclePresent ? offThreshold : onThreshold);
+        if(detected == vehiclePresent){
+            disagreeing = 0;
+            return false;
+        }
+        if(++disagreeing < debounce){ // A burst of noise, not a vehicle
+            return false;
+        }
+        disagreeing = 0;
+        if(!detected){
+            departures++; // Counted here, so a vehicle is never missed between passes
+        }
+        vehiclePresent = detected;
+        *indicator = detected;
+        return true;
+    }
+
+    public:
+    // Constructor
+        TL_Sensor(DigitalOut* _irEmitter, AnalogIn* _irReceiver, DigitalOut* _indicator, float _sensitivity)
+    : irEmitter(_irEmitter)
+    , irReceiver(_irReceiver)
+    , indicator(_indicator)
+    , onThreshold((int32_t)(_sensitivity * 65535.0f))
+    , offThreshold(onThreshold > hysteresis ? onThreshold - hysteresis : 0)
+    , ambientLevel(0)
+    , baseline(0)
+    , darkReading(0)
+    , emitterLit(false)
+    , emitterOnAt(0)
+    , emitterMicros(0)
+    , primed(false)
+    , vehiclePresent(false)
+    , departures(0)
+    , disagreeing(0)
+    , medianSum(0)
+    , burstIndex(0)
+    , medianIndex(0)
+    {
+        for(int i = 0; i < 3; i++){
+            bursts[i] = 0;
+        }
+        for(int i = 0; i < averageLength; i++){
+            medians[i] = 0;
+        }
+        //Initially set all LEDs to off
+        *irEmitter = 0;
+        *indicator = 0;
+    }
+
+    // Current ambient light reading, tracked continuously by sample().
+    float ambient(){
+        return (ambientLevel >> ambientShift) / 65535.0f;
+    }
+
+    // Take one sample, from the sampling interrupt. Ticks alternate between
+    // emitter off and emitter on, one sample period apart so the LED has
+    // settled. The reflection is the lit reading minus the dark one just
+    // before it, so ambient IR (and its drift with the sun) cancels out
+    // without ever stopping to calibrate. The reflection is filtered, then
+    // compared, less the slowly tracked empty road baseline, against on/off
+    // thresholds with hysteresis, and has to stay past one for a few samples
+    // before it counts. Returns true when the detection state changes.
+    bool sample(){
+        int32_t reading = readBurst();
+        if(!emitterLit){
+            takeDark(reading);
+            emitterLit = true;
+            *irEmitter = 1; // Lit for the next tick
+            emitterOnAt = us_ticker_read();
+            return false;
+        }
+        emitterLit = false;
+        *irEmitter = 0; // Dark for the next tick
+        emitterMicros += us_ticker_read() - emitterOnAt;
+        return takeLit(reading);
+    }
+
+    // Low power: instead of sample(), a pulse per sample period, so the
+    // emitter is dark for all but a fraction of it. startPulse() takes the
+    // dark reading and lights the emitter; finishPulse(), EMITTER_SETTLE_US
+    // later, takes the lit one and darkens it again. Both from interrupts.
+    // The dark reading is safe because the emitter went dark at the end of
+    // the last pulse, a whole sample period ago. If sample() left it lit,
+    // this pulse only darkens it, so the next one reads after it has faded.
+    void startPulse(){
+        if(emitterLit){
+            *irEmitter = 0;
+            emitterMicros += us_ticker_read() - emitterOnAt; // Left lit by sample()
+            emitterLit = false;
+            return;
+        }
+        takeDark(readBurst());
+        emitterLit = true;
+        *irEmitter = 1;
+        emitterOnAt = us_ticker_read();
+    }
+
+    // Returns true when the detection state changes.
+    bool finishPulse(){
+        if(!emitterLit){ // startPulse() only darkened the emitter
+            return false;
+        }
+        int32_t reading = readBurst();
+        emitterLit = false;
+        *irEmitter = 0;
+        emitterMicros += us_ticker_read() - emitterOnAt;
+        return takeLit(reading);
+    }
+
+    // Time the emitter has been lit since power up, in microseconds.
+    uint64_t emitterOnTime(){
+        __disable_irq();
+        uint64_t micros = emitterMicros;
+        __enable_irq();
+        return micros;
+    }
+
+    // Method for reporting back if a Vehicle is detected.
+    bool checkForVehicle(){
+        return vehiclePresent;
+    }
+
+    // Running count of vehicles that have left; compare with an earlier value.
+    uint16_t departureCount(){
+        return departures;
+    }
+};
+
+#endif
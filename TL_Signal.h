@@ -0,0 +1,39 @@
+#ifndef TL_SIGNAL_H
+#define TL_SIGNAL_H
+
+#include "mbed.h"
+
+// Class for the Signal Lamps
+class TL_Signal{
+    friend class Junction; // Allow Junction class to access private members
+    private:
+        // Define the IO, private as they should not be accessible outside of class
+        DigitalOut* Red_Light;
+        DigitalOut* Green_Light;
+        bool isGreen; // Flag to indicate if the Junction is on Green
+
+    public: 
+        // Constructor
+        TL_Signal(DigitalOut* red, DigitalOut* green)
+        : Red_Light(red)
+        , Green_Light(green)
+        {
+            //Set Junction to Red initially
+            *Red_Light = 1;
+            *Green_Light = 0;
+            isGreen = false;
+        }
+
+        void turnGreen(){
+            *Red_Light = 0;
+            *Green_Light = 1;
+            isGreen = true;
+        }
+        void turnRed(){
+            *Green_Light = 0;
+            *Red_Light = 1;
+            isGreen = false;
+        }
+};
+
+#endif
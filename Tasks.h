@@ -0,0 +1,106 @@
+#ifndef TASKS_H
+#define TASKS_H
+
+#include "mbed.h"
+#include "LoopProfiler.h"
+#include "Scheduler.h"
+
+// The firmware's work, by priority:
+//
+//   Sensing     Sensor ticker interrupt (Controller::sampleSensors). Preempts
+//               everything below; hands each edge to control in a queue.
+//   Control     TASK_CONTROL: applies remote commands, runs the signals and
+//               the crossing, arms the next wake-up.
+//   Comms       TASK_COMMS: decodes received bytes into command batches, for
+//               control in a queue. Telemetry goes out from the UART's TX
+//               interrupt, from a queue control fills.
+//
+// The tasks run to completion, one at a time, on the main stack: after each
+// one the runner goes back to the highest priority task that is ready, so
+// control never waits behind more than one slice of a lower task. Tasks only
+// talk through the queues, so none holds another up by taking its time.
+enum TaskId {
+    TASK_CONTROL, // Highest first
+    TASK_COMMS,
+    TASK_COUNT
+};
+
+class TaskRunner {
+    private:
+    struct Task {
+        Callback<void()> body;
+        uint32_t events; // Scheduler events that make it ready
+        uint32_t woken; // Events it has been made ready by since it last ran
+    };
+
+    Task tasks[TASK_COUNT];
+    Scheduler* scheduler;
+    LoopProfiler* profiler; // May be NULL
+    uint32_t ready; // One bit per task
+    uint32_t running; // Events the running task was made ready by
+
+    public:
+    TaskRunner(Scheduler* _scheduler, LoopProfiler* _profiler = NULL)
+    : scheduler(_scheduler)
+    , profiler(_profiler)
+    , ready(0)
+    , running(0) {
+        for(int t = 0; t < TASK_COUNT; t++){
+            tasks[t].events = 0;
+            tasks[t].woken = 0;
+        }
+    }
+
+    void add(TaskId task, uint32_t events, Callback<void()> body){
+        tasks[task].body = body;
+        tasks[task].events = events;
+    }
+
+    // From a task: run 'task' (again) once nothing more urgent is ready, e.g.
+    // after queueing it work, or to carry on with a job in slices.
+    void signal(TaskId task){
+        ready |= 1 << task;
+    }
+
+    // The events that made the running task ready.
+    uint32_t events(){
+        return running;
+    }
+
+    // Run the tasks for ever, sleeping whenever none is ready.
+    void run(){
+        uint32_t passBegan = 0;
+        while(1){
+            uint32_t events;
+            if(ready){
+                events = scheduler->take(); // Anything posted while the last task ran
+            } else {
+                events = scheduler->waitForEvent();
+                if(profiler){
+                    profiler->tick(PERIOD_WAKE);
+                    passBegan = profiler->begin();
+                }
+            }
+            for(int t = 0; t < TASK_COUNT; t++){
+                if(events & tasks[t].events){
+                    tasks[t].woken |= events & tasks[t].events;
+                    ready |= 1 << t;
+                }
+            }
+            for(int t = 0; t < TASK_COUNT; t++){
+                if(ready & (1 << t)){
+                    ready &= ~(1 << t);
+                    running = tasks[t].woken;
+                    tasks[t].woken = 0;
+                    tasks[t].body();
+                    break;
+                }
+            }
+            if(!ready && profiler){
+                profiler->end(STAGE_PASS, passBegan); // Back to sleep
+            }
+        }
+    }
+};
+
+#endif
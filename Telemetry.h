@@ -0,0 +1,214 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include "mbed.h"
+#include "LoopProfiler.h"
+#include "RingBuffer.h"
+#include "TelemetryBlock.h"
+
+// Every message the controller can report. The text lives in flash (see
+// Telemetry::format), so logging one only queues a small record.
+enum TelemetryMessage {
+    MSG_STARTING_UP,
+    MSG_STARTUP_COMPLETE,
+    MSG_VEHICLE_WAITING,
+    MSG_VEHICLES_LEFT, // value: vehicles left before the limit
+    MSG_TURNED_RED,
+    MSG_TURNED_GREEN,
+    MSG_CALIBRATION, // value: ambient reading in hundredths
+    MSG_TIMED_OUT, // source: approach being reverted to
+    MSG_PED_WAITING,
+    MSG_PED_GREEN,
+    MSG_PED_COUNTDOWN,
+    MSG_PED_RED,
+    MSG_STOPPED,
+    MSG_RESTARTED, // source: first approach in the phase resumed into
+    MSG_DROPPED, // value: records lost since the last report
+    MSG_GREEN_TIME, // source: first approach in the phase, value: green time in seconds
+    MSG_VEHICLE_LIMIT, // source: approach that let its surplus vehicles through
+    MSG_FRAME_APPLIED, // value: frame sequence number
+    MSG_FRAME_REJECTED, // source: reason, value: frame sequence number
+    MSG_VEHICLE_COUNT, // value: vehicles counted since power up
+    MSG_COUNTER, // source: counter name
+    MSG_BLOCK, // source: what follows, value: bytes of binary after the line
+    MSG_COORDINATED, // source: first approach in the default phase, value: offset in seconds
+    MSG_CONFLICT, // source: what was lit, value: the greens, one bit per approach
+    MSG_AWAKE, // value: hundredths of a percent of the time the core was awake
+    MSG_EMITTER_DUTY, // source: approach, value: hundredths of a percent of the time its emitter was lit
+    MSG_POWER_DRAW, // value: estimated average draw in milliwatts
+    MSG_COUNT
+};
+
+struct TelemetryRecord {
+    const char* source; // Name of the reporting junction, must outlive the record
+    int32_t value;
+    uint8_t message;
+};
+
+// Non-blocking log channel over a Serial port. log() queues a record and
+// returns; the UART's TX interrupt formats records and feeds the FIFO. When the
+// queue is full the record is dropped and counted, never waited for.
+class Telemetry {
+    private:
+    RawSerial* serial;
+    RingBuffer<TelemetryRecord, 64> records;
+    volatile bool transmitting; // TX interrupt attached and draining
+    uint32_t droppedCount; // Total records lost to a full queue
+    uint32_t unreportedDrops; // Lost since the last MSG_DROPPED went out
+    TelemetryBlock* volatile block; // Binary to follow the MSG_BLOCK line, NULL if none queued
+    LoopProfiler* profiler; // Times the TX interrupt, may be NULL
+    bool sendingBlock; // Line done, now sending 'block'
+
+    // Line being sent by the TX interrupt
+    char line[96];
+    int lineLength;
+    int linePosition;
+
+    static const char* text(uint8_t message){
+        static const char* const texts[MSG_COUNT] = {
+            "Starting up...",
+            "Start up complete.",
+            "%s: Vehicle Waiting",
+            "%s: %i vehicles left to pass.",
+            "%s: Turned Red",
+            "%s: Turned Green",
+            "%s: Sensor Calibration - %d.%02d",
+            "Lights timed out, reverting to %s",
+            "Pedestrian Waiting...",
+            "Pedestrian Crossing is Green",
+            "Starting Pedestrian Countdown",
+            "Pedestrian Crossing is Red",
+            "All functions stopped, send Go to restart.",
+            "Functions restarted, %s first.",
+            "%i messages dropped",
+            "%s: Green time now %i s",
+            "%s: Vehicle limit reached, changing",
+            "Frame %i applied",
+            "%s, frame %i rejected",
+            "%s: %i vehicles counted",
+            "%s: %i",
+            "%s: %i bytes follow",
+            "On the common cycle, %s green at %i s",
+            "Conflict: %s lit (greens %i), all red until Go",
+            "Awake %d.%02d%% of the time",
+            "%s: Emitter lit %d.%02d%% of the time",
+            "Estimated draw %i mW"
+        };
+        return message < MSG_COUNT ? texts[message] : "?";
+    }
+
+    // Expand a record into 'line'. Integer formatting only, as this runs in the interrupt.
+    void format(const TelemetryRecord& record){
+        const char* source = record.source ? record.source : "";
+        int length;
+        if(record.message == MSG_CALIBRATION || record.message == MSG_EMITTER_DUTY){
+            length = snprintf(line, sizeof(line) - 1, text(record.message), source, (int)(record.value / 100), (int)(record.value % 100));
+        } else if(record.message == MSG_AWAKE){
+            length = snprintf(line, sizeof(line) - 1, text(record.message), (int)(record.value / 100), (int)(record.value % 100));
+        } else if(record.message == MSG_DROPPED || record.message == MSG_FRAME_APPLIED || record.message == MSG_POWER_DRAW){
+            length = snprintf(line, sizeof(line) - 1, text(record.message), (int)record.value);
+        } else {
+            length = snprintf(line, sizeof(line) - 1, text(record.message), source, (int)record.value);
+        }
+        if(length < 0 || length > (int)sizeof(line) - 2){
+            length = sizeof(line) - 2;
+        }
+        line[length++] = '\n';
+        lineLength = length;
+        linePosition = 0;
+    }
+
+    // TX interrupt: keep the UART FIFO topped up, and switch off once the queue is empty.
+    void onTxReady(){
+        uint32_t began = profiler ? profiler->begin() : 0;
+        while(serial->writeable()){
+            if(linePosition >= lineLength){
+                if(sendingBlock){
+                    uint8_t byte;
+                    if(block->nextByte(byte)){
+                        serial->putc(byte);
+                        continue;
+                    }
+                    sendingBlock = false;
+                    block = 0;
+                }
+                TelemetryRecord record;
+                if(!records.pop(record)){
+                    transmitting = false;
+                    serial->attach(Callback<void()>(), RawSerial::TxIrq);
+                    break;
+                }
+                format(record);
+                sendingBlock = record.message == MSG_BLOCK; // Straight after this line
+            }
+            serial->putc(line[linePosition++]);
+        }
+        if(profiler){
+            profiler->end(STAGE_TELEMETRY, began);
+        }
+    }
+
+    bool queue(uint8_t message, const char* source, int32_t value){
+        TelemetryRecord record;
+        record.source = source;
+        record.value = value;
+        record.message = message;
+        return records.push(record);
+    }
+
+    public:
+    Telemetry(RawSerial* _serial, LoopProfiler* _profiler = 0)
+    : serial(_serial)
+    , transmitting(false)
+    , droppedCount(0)
+    , unreportedDrops(0)
+    , block(0)
+    , profiler(_profiler)
+    , sendingBlock(false)
+    , lineLength(0)
+    , linePosition(0) {}
+
+    // Queue a message for sending. Main loop only (single producer).
+    void log(TelemetryMessage message, const char* source = 0, int32_t value = 0){
+        // Say how much was lost before carrying on, once there is room to
+        if(unreportedDrops && queue(MSG_DROPPED, 0, unreportedDrops)){
+            unreportedDrops = 0;
+        }
+        if(unreportedDrops || !queue(message, source, value)){
+            droppedCount++;
+            unreportedDrops++;
+        }
+
+        // Start the TX interrupt if it has gone idle. It only fires when the FIFO
+        // empties, so fill the FIFO here to get it going.
+        __disable_irq();
+        if(!transmitting){
+            transmitting = true;
+            serial->attach(callback(this, &Telemetry::onTxReady), RawSerial::TxIrq);
+            onTxReady();
+        }
+        __enable_irq();
+    }
+
+    // Queue a line announcing 'length' bytes of binary, which 'source' then
+    // supplies from the TX interrupt. One block at a time; false if busy.
+    bool logBlock(const char* name, int32_t length, TelemetryBlock* source){
+        if(block){
+            return false;
+        }
+        block = source;
+        uint32_t before = droppedCount;
+        log(MSG_BLOCK, name, length);
+        if(droppedCount != before){
+            block = 0; // The line never made the queue, so neither will the block
+            return false;
+        }
+        return true;
+    }
+
+    uint32_t dropped(){
+        return droppedCount;
+    }
+};
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef TELEMETRYBLOCK_H
+#define TELEMETRYBLOCK_H
+
+#include "mbed.h"
+
+// Raw bytes sent straight after a text line, e.g. a recording dump. The line
+// says how many follow, so the receiver knows where the text picks up again.
+class TelemetryBlock {
+    public:
+    // TX interrupt: the next byte, or false once the block has all gone.
+    virtual bool nextByte(uint8_t& byte) = 0;
+};
+
+#endif
@@ -0,0 +1,172 @@
+#ifndef TRAFFICRECORDER_H
+#define TRAFFICRECORDER_H
+
+#include "mbed.h"
+#include "Recording.h"
+#include "Scheduler.h"
+#include "TelemetryBlock.h"
+
+// Keeps the last few thousand events in a RAM ring buffer of packed,
+// delta-timestamped records (see Recording.h), overwriting the oldest, and
+// sends them all in one go when asked. Records are written by the main loop;
+// a dump is read out by the telemetry TX interrupt. While a dump is running
+// nothing it has still to send is overwritten: new records are dropped instead
+// (and counted), and their time carries over to the next one that fits.
+class TrafficRecorder : public TelemetryBlock {
+    private:
+    Record* records; // Storage, 'capacity' records
+    const unsigned capacity; // Power of two
+    unsigned head; // Next record to write
+    unsigned tail; // Oldest record
+    Scheduler* scheduler; // Time since power up, for records stamped now
+    uint64_t lastTime; // Microseconds since power up the newest record's time counts to
+    uint64_t baseTime; // Milliseconds since power up, just before the oldest record
+    uint32_t overwritten;
+    uint32_t droppedWhileDumping;
+
+    // Dump in progress, read out by the TX interrupt
+    volatile bool dumping;
+    uint8_t header[sizeof(RecordingHeader)];
+    unsigned dumpPosition; // Bytes sent so far
+    unsigned dumpLength;
+    unsigned dumpStart; // First record in the dump
+
+    bool write(uint8_t kind, int index, int value, uint32_t delta){
+        unsigned next = (head + 1) & (capacity - 1);
+        if(next == tail){
+            if(dumping){
+                droppedWhileDumping++;
+                return false;
+            }
+            // Full: the oldest record goes, and its time moves into the base
+            baseTime += recordDelta(records[tail]);
+            tail = (tail + 1) & (capacity - 1);
+            overwritten++;
+        }
+        Record& record = records[head];
+        record.delta[0] = (uint8_t)delta;
+        record.delta[1] = (uint8_t)(delta >> 8);
+        record.kindIndex = (uint8_t)((kind << 3) | (index & 0x07));
+        record.value = (uint8_t)value;
+        head = next;
+        return true;
+    }
+
+    static void put(uint8_t* bytes, uint64_t value, int size){
+        for(int i = 0; i < size; i++){
+            bytes[i] = (uint8_t)(value >> (8 * i));
+        }
+    }
+
+    public:
+    // 'storage' must hold 'size' records, a power of two.
+    TrafficRecorder(Record* storage, unsigned size, Scheduler* _scheduler)
+    : records(storage)
+    , capacity(size)
+    , head(0)
+    , tail(0)
+    , scheduler(_scheduler)
+    , lastTime(0)
+    , baseTime(0)
+    , overwritten(0)
+    , droppedWhileDumping(0)
+    , dumping(false)
+    , dumpPosition(0)
+    , dumpLength(0)
+    , dumpStart(0) {}
+
+    // Add an event that happens now.
+    void record(RecordKind kind, int index = 0, int value = 0){
+        record(kind, index, value, scheduler->sincePowerUp());
+    }
+
+    // Add an event that happened at 'time', in microseconds since power up.
+    // Events must come in time order; one stamped earlier than the last is
+    // taken as simultaneous. 'value' is kept to 0..RECORD_VALUE_MAX.
+    void record(RecordKind kind, int index, int value, uint64_t time){
+        value = value < 0 ? 0 : (value > (int)RECORD_VALUE_MAX ? (int)RECORD_VALUE_MAX : value);
+        uint64_t delta = time > lastTime ? (time - lastTime) / 1000 : 0;
+        while(delta > 0xFFFF){
+            // Carry the long gap in time records, up to 4.6 hours each
+            uint32_t skip = delta > 0xFFFFFF ? 0xFFFFFF : (uint32_t)delta;
+            if(!write(REC_TIME, 0, skip >> 16, skip & 0xFFFF)){
+                return;
+            }
+            lastTime += (uint64_t)skip * 1000;
+            delta -= skip;
+        }
+        if(value > 255){
+            // The high byte goes first, taking the time; both go or neither
+            if(!write(REC_VALUE_HIGH, 0, value >> 8, (uint32_t)delta)){
+                return;
+            }
+            if(!write(kind, index, value & 0xFF, 0)){
+                head = (head - 1) & (capacity - 1);
+                return;
+            }
+        } else if(!write(kind, index, value, (uint32_t)delta)){
+            return;
+        }
+        lastTime += delta * 1000;
+    }
+
+    // Start sending the whole buffer, oldest first. Returns the number of bytes
+    // the dump will take, or 0 if one is already running.
+    unsigned startDump(){
+        if(dumping){
+            return 0;
+        }
+        unsigned count = (head - tail) & (capacity - 1);
+        for(int i = 0; i < 4; i++){
+            header[i] = RECORDING_MAGIC[i];
+        }
+        header[4] = RECORDING_VERSION;
+        header[5] = sizeof(Record);
+        header[6] = (uint8_t)count;
+        header[7] = (uint8_t)(count >> 8);
+        put(header + 8, overwritten, 4);
+        put(header + 12, 0, 4);
+        put(header + 16, baseTime, 8);
+        dumpStart = tail;
+        dumpPosition = 0;
+        dumpLength = sizeof(header) + count * sizeof(Record);
+        __DMB();
+        dumping = true;
+        return dumpLength;
+    }
+
+    // Give up on a dump that startDump() set up but that never got sent.
+    void cancelDump(){
+        dumping = false;
+    }
+
+    // TX interrupt: the next byte of the dump, false once it has all gone.
+    bool nextByte(uint8_t& byte){
+        if(!dumping){
+            return false;
+        }
+        if(dumpPosition < sizeof(header)){
+            byte = header[dumpPosition];
+        } else {
+            unsigned offset = dumpPosition - sizeof(header);
+            const Record& record = records[(dumpStart + offset / sizeof(Record)) & (capacity - 1)];
+            byte = ((const uint8_t*)&record)[offset % sizeof(Record)];
+        }
+        if(++dumpPosition == dumpLength){
+            __DMB();
+            dumping = false;
+        }
+        return true;
+    }
+
+    unsigned count(){
+        return (head - tail) & (capacity - 1);
+    }
+
+    // Records lost: overwritten when full, or dropped during a dump
+    uint32_t lost(){
+        return overwritten + droppedWhileDumping;
+    }
+};
+
+#endif
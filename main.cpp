@@ -1,293 +1,387 @@
 #include "mbed.h"
-#include <string>
-
+#include "CommandProtocol.h"
+#include "Controller.h"
+#include "GreenTimeOptimizer.h"
+#include "Junction.h"
+#include "LoopProfiler.h"
+#include "NoHeap.h"
+#include "PedestrianCrossing.h"
+#include "PhasePlan.h"
+#include "PowerManager.h"
+#include "RingBuffer.h"
+#include "SafetyMonitor.h"
+#include "Scheduler.h"
+#include "SegmentDisplay.h"
+#include "SiteSettings.h"
+#include "Tasks.h"
+#include "Telemetry.h"
+#include "TrafficRecorder.h"
+
+// Everything below belongs to one site. On the board there is only ever one;
+// the corridor simulator (sim/corridor.cpp) runs several sites in one process,
+// a thread each, so there each thread gets its own copy.
+#ifdef TL_HOST_SIM
+#define SITE_LOCAL thread_local
+#else
+#define SITE_LOCAL
+#endif
+
+#ifdef TL_HOST_SIM
+// For the host tools (sim/bench.cpp): this thread's controller, once main() has built it
+SITE_LOCAL Controller* simController = NULL;
+Controller* tl_controller(){
+    return simController;
+}
+#endif
 
 //Junction 1 Setup
-DigitalOut rLight_J1(p11); // Red Traffic Signal
-DigitalOut gLight_J1(p12); // Green Traffic Signal
-DigitalOut irTx_J1(p19); // IR Emitter
-AnalogIn irRx_J1(p20); // IR Receiver
-DigitalOut ind_J1(p15); // Sensor Indicator
+SITE_LOCAL DigitalOut rLight_J1(p11); // Red Traffic Signal
+SITE_LOCAL DigitalOut gLight_J1(p12); // Green Traffic Signal
+SITE_LOCAL DigitalOut irTx_J1(p19); // IR Emitter
+SITE_LOCAL AnalogIn irRx_J1(p20); // IR Receiver
+SITE_LOCAL DigitalOut ind_J1(p15); // Sensor Indicator
 
 //Junction 2 Setup
-DigitalOut rLight_J2(p13); // Red Traffic Signal
-DigitalOut gLight_J2(p14); // Green Traffic Signal
-DigitalOut irTx_J2(p17); // IR Emitter
-AnalogIn irRx_J2(p18); // IR Receiver
-DigitalOut ind_J2(p16); // Sensor Indicator
+SITE_LOCAL DigitalOut rLight_J2(p13); // Red Traffic Signal
+SITE_LOCAL DigitalOut gLight_J2(p14); // Green Traffic Signal
+SITE_LOCAL DigitalOut irTx_J2(p17); // IR Emitter
+SITE_LOCAL AnalogIn irRx_J2(p18); // IR Receiver
+SITE_LOCAL DigitalOut ind_J2(p16); // Sensor Indicator
 
 // Pedestrian Crossing
-InterruptIn pedSwitch(p21);  // Pedestrian Request Switch
-DigitalOut pedRed(p22);  // Red Pedestrian Signal
-DigitalOut pedGreen(p23);  // Green Pedestrian Signal
-BusOut segment(p24,p25,p26,p27,p28,p29,p30); // Pedestrian Timer (e,d,c,g,f,a,b)
+SITE_LOCAL InterruptIn pedSwitch(p21);  // Pedestrian Request Switch
+SITE_LOCAL DigitalOut pedRed(p22);  // Red Pedestrian Signal
+SITE_LOCAL DigitalOut pedGreen(p23);  // Green Pedestrian Signal
+SITE_LOCAL BusOut segment(p24,p25,p26,p27,p28,p29,p30); // Pedestrian Timer (e,d,c,g,f,a,b)
+SITE_LOCAL SegmentDisplay pedDisplay(&segment); // One digit, so no multiplexing
 
 // Bluetooth Adapter
-Serial bth(p9,p10,9600);
+SITE_LOCAL RawSerial bth(p9,p10,9600); // Raw: no stdio stream, so no heap
+SITE_LOCAL RingBuffer<char, 128> rxBuffer; // Bytes received by interrupt, waiting for the main loop
+
+// Wakes the main loop when something needs attention
+SITE_LOCAL Scheduler scheduler;
+
+// Stage timings, with the report kept in the first AHB SRAM bank (USB, unused here)
+#ifdef TL_HOST_SIM
+SITE_LOCAL char timingReport[1536];
+#else
+char timingReport[1536] __attribute__((section("AHBSRAM0")));
+#endif
+SITE_LOCAL LoopProfiler profiler(timingReport, sizeof(timingReport), &scheduler);
+
+SITE_LOCAL Telemetry telemetry(&bth, &profiler); // Status reports, sent in the background
+SITE_LOCAL CommandParser commandParser; // Remote control frames, see CommandProtocol.h
+SITE_LOCAL RingBuffer<CommandBatch, 4> batches; // Decoded by the comms task, waiting for the control task
+
+SITE_LOCAL TaskRunner tasks(&scheduler, &profiler); // Runs the main loop's tasks (see Tasks.h)
+SITE_LOCAL Ticker sensorTicker; // Samples the presence sensors in the background
+
+// Traffic recording: 4096 records (16KB) kept in the second AHB SRAM bank, which
+// nothing else on this board uses, so it costs none of the main RAM.
+#ifdef TL_HOST_SIM
+SITE_LOCAL Record recording[4096];
+#else
+Record recording[4096] __attribute__((section("AHBSRAM1")));
+#endif
+SITE_LOCAL TrafficRecorder recorder(recording, sizeof(recording) / sizeof(recording[0]), &scheduler);
+
+// Rough supply currents for this board, for the power report (see PowerManager.h)
+const PowerModel siteSupply = {
+    3.3f, // Volts
+    42, // Milliamps with the core awake (96 MHz)
+    20, // Milliamps with it asleep
+    20 // Milliamps through each IR emitter while lit
+};
+SITE_LOCAL PowerManager power(&sensorTicker, &scheduler, &telemetry, siteSupply, &profiler);
 
-// Class for the Presence Sensor
-class TL_Sensor{
-    private:
-    // Define the IO, private as they should not be accessible outside of class
-    DigitalOut* irEmitter; // IR Emitter LED
-    AnalogIn* irReceiver; // IR Receiver LED
-    DigitalOut* indicator; // Indicator LED for notifying operator is object detected
-    const float sensitivity; // Sensor Sensivitity
-    float ambientReading; // To account for Ambient IR light 
-    
-    // Take a reading of IR level, adjusting for the ambient IR light.
-    float takeIRReading(){
-         return (irReceiver->read() - ambientReading);        
+
+// Phase plan for this intersection: the two junctions take turns, resting on Junction 1
+constexpr FixedPhasePlan<2, 2> sitePlan = {
+    { 0x02, 0x01 }, // Conflicts: Junction 1 with Junction 2, and Junction 2 with Junction 1
+    { 0x01, 0x02 }, // Phases: Junction 1 green, then Junction 2 green
+    0 // Default phase: Junction 1 green
+};
+static_assert(sitePlan.isSafe(), "Phase plan turns conflicting approaches green together");
+
+// Conflict monitor: checks the signal outputs themselves against the plan, every
+// millisecond, and forces all red if they ever conflict
+SITE_LOCAL DigitalOut* const signalReds[] = { &rLight_J1, &rLight_J2 };
+SITE_LOCAL DigitalOut* const signalGreens[] = { &gLight_J1, &gLight_J2 };
+SITE_LOCAL SafetyMonitor safety(signalReds, signalGreens, sitePlan.plan(), &pedRed, &pedGreen, &scheduler);
+
+// Declared globally to work with interrupt
+SITE_LOCAL PedestrianCrossing ped( 
+    &pedRed,
+    &pedGreen,
+    &pedDisplay,
+    &telemetry,
+    1, // Seconds per countdown digit
+    2 // Seconds of all red before traffic moves again
+);
+
+//Interrupt function for pedestrian Crossing
+void StartPedTimer(){ //
+    ped.StartWaitingTimer();
+    scheduler.post(EVENT_PED_REQUEST);
+}
+
+//Interrupt function for Bluetooth data, must empty the UART or it will fire again
+void BluetoothReceived(){
+    while(bth.readable()){
+        rxBuffer.push(bth.getc()); // Dropped if the main loop is 128 bytes behind
     }
-    
-    public:
-    // Constructor
-        TL_Sensor(DigitalOut* _irEmitter, AnalogIn* _irReceiver, DigitalOut* _indicator, float _sensitivity)
-    : irEmitter(_irEmitter)
-    , irReceiver(_irReceiver)
-    , indicator(_indicator)
-    , sensitivity(_sensitivity)
-    {
-        //Initially set all LEDs to off
-        *irEmitter = 0;
-        *indicator = 0;     
-    } 
-
-    // Update ambient light reading. (Only to be run on start up or on command, do not use in main loop)
-    float calibrate(){
-            *irEmitter = 0; // Turn off emitter, as to not skew the results
-            wait(0.2); // Allow for time to completely turn off.
-            ambientReading = irReceiver->read(); // Take reading.
-            wait(0.2); // Wait before switching emitter back on.
-            *irEmitter = 1;
-            return ambientReading;
+    scheduler.post(EVENT_BLUETOOTH);
+}
+
+// CMD_SET_TIMING's change to 'settings'.
+void setTimingField(ControllerTiming& settings, const Command& command){
+    float seconds = command.value / 1000.0f;
+    switch(command.target){
+        case TIMING_SAFE_PASSAGE: settings.safePassageTime = seconds; break;
+        case TIMING_TRANSITION: settings.transitionTime = seconds; break;
+        case TIMING_PED_WAIT: settings.pedWaitLimit = seconds; break;
+        case TIMING_TIMEOUT: settings.timeoutTime = seconds; break;
+        default: break;
     }
+}
 
-    // Method for reporting back if a Vehicle is detected.
-    bool checkForVehicle(){
-        if(takeIRReading() > sensitivity){
-            *indicator = 1;
-            return true;
-        } else {
-            *indicator = 0;
-            return false;
-        }
+// CMD_SET_COORDINATION's change to 'settings'.
+void setCoordinationField(CoordinationSettings& settings, const Command& command){
+    float seconds = command.value / 10.0f;
+    switch(command.target){
+        case COORD_CYCLE: settings.cycle = seconds; break;
+        case COORD_OFFSET: settings.offset = seconds; break;
+        case COORD_BAND: settings.band = seconds; break;
+        case COORD_MIN_SIDE_GREEN: settings.minSideGreen = seconds; break;
+        default: break;
     }
+}
+
+// The settings a frame leaves the controller with, followed through it so that
+// ones that depend on each other are checked together (see validFrame).
+struct StagedSettings {
+    ControllerTiming timing;
+    bool adaptive;
+    CoordinationSettings corridor;
 };
 
-// Class for the Signal Lamps
-class TL_Signal{
-    friend class Junction; // Allow Junction class to access private members
-    private:
-        // Define the IO, private as they should not be accessible outside of class
-        DigitalOut* Red_Light;
-        DigitalOut* Green_Light;
-        bool isGreen; // Flag to indicate if the Junction is on Green
-
-    public: 
-        // Constructor
-        TL_Signal(DigitalOut* red, DigitalOut* green)
-        : Red_Light(red)
-        , Green_Light(green)
-        {
-            //Set Junction to Red initially
-            *Red_Light = 1;
-            *Green_Light = 0;
-            isGreen = false;
+// Check a remote command against this site before anything in its frame is
+// applied, and stage its settings.
+bool validCommand(const Command& command, Controller& controller, StagedSettings& staged){
+    switch(command.opcode){
+        case CMD_REQUEST_APPROACH:
+        return command.target >= 1 && command.target <= controller.approachCount();
+
+        case CMD_FORCE_PHASE:
+        return command.target >= 1 && command.target <= controller.phaseCount();
+
+        case CMD_SET_TIMING:
+        setTimingField(staged.timing, command);
+        // The all red transition is the crossing's clearance time, never less than a second
+        if(command.target == TIMING_TRANSITION){
+            return command.value >= 1000;
         }
+        return command.target < TIMING_FIELD_COUNT && command.value > 0;
 
-        void turnGreen(){
-            *Red_Light = 0;
-            *Green_Light = 1;
-            isGreen = true;
-        }
-        void turnRed(){
-            *Green_Light = 0;
-            *Red_Light = 1;
-            isGreen = false;
-        }
-};
+        case CMD_SET_VEHICLE_LIMIT:
+        return command.target >= 1 && command.target <= controller.approachCount() && command.value >= 1;
 
-//Class for the entire Junction
-class Junction{
-    private:
-    /*Do not allow the hardware to be directly accessible in main.*/
-    TL_Sensor sensor; //Instance of the Presence sensor object
-    TL_Signal signal; //Instance of the Traffic Light Signals object
+        case CMD_SET_COORDINATION:
+        setCoordinationField(staged.corridor, command);
+        return command.target < COORD_FIELD_COUNT;
 
-    string junctionName; //Name of the Junction, used for monitoring
-    bool previousSensorState; // Temp variable for holding previous state of junction (for counting vehicles)
+        case CMD_SET_ADAPTIVE:
+        staged.adaptive = command.target != 0;
+        return command.target <= 1;
 
-    public:
-     
-    int surplusVehicleLimit; // Max vehicle count (while other junction waiting)
-    bool changeTriggered; // Flag variable for triggering junction without vehicle waiting.
-    bool vehicleCounterStarted; // Flag for enabling/disabling vehicle counting.
-    int surplusVehicleCount; // Current vehicle count (while other junction waiting)
-    bool remoteTrigger; // Allows for bluetooth override
-
-
-    //Constructor
-    Junction(string _junctionName, DigitalOut* _irEmitter, AnalogIn* _irReceiver, DigitalOut* _indicatorLamp, float _sensitivity, DigitalOut* _redLight, DigitalOut* _greenLight, int _surplusVehicleLimit)
-        : junctionName(_junctionName)
-        , sensor(_irEmitter, _irReceiver, _indicatorLamp, _sensitivity)
-        , signal(_redLight,_greenLight)
-        , surplusVehicleLimit(_surplusVehicleLimit){
-            // Set initial values
-            changeTriggered = false;
-            vehicleCounterStarted = false;
-            previousSensorState = false;
-            surplusVehicleCount = 0;
-            remoteTrigger = false;
+        case CMD_SET_LOW_POWER:
+        return command.target <= 1;
+
+        default:
+        return true;
     }
+}
 
-    // Accessible method to check state of Junction
-    bool isGreen(){
-        return signal.isGreen;
+// Check what the whole frame leaves: on a common cycle (0 leaves the corridor),
+// one this site can run with the frame's timing, and the offset a point in it.
+bool validFrame(const StagedSettings& staged, Controller& controller){
+    const CoordinationSettings& corridor = staged.corridor;
+    if(corridor.cycle == 0){
+        return true;
     }
+    return corridor.cycle >= controller.shortestCycle(staged.timing, staged.adaptive)
+        && corridor.cycle <= controller.longestCycle(staged.timing, staged.adaptive)
+        && corridor.offset < corridor.cycle;
+}
+
+void applyCommand(const Command& command, Controller& controller){
+    switch (command.opcode){
+
+        // Change to the numbered junction (1 for Junction 1, and so on).
+        case CMD_REQUEST_APPROACH: controller.requestApproach(command.target - 1); break;
+
+        case CMD_FORCE_PHASE: controller.forcePhase(command.target - 1); break;
+
+        // Switch to pedestrian crossing
+        case CMD_PED_REQUEST: ped.remoteTrigger = true; break;
+
+        // Report the IR sensor calibration on command.
+        case CMD_REPORT_SENSORS: controller.reportSensors(); break;
+
+        case CMD_QUERY_COUNTERS:
+        controller.reportCounters();
+        telemetry.log(MSG_COUNTER, "Bytes discarded", commandParser.discarded());
+        telemetry.log(MSG_COUNTER, "Records lost", recorder.lost());
+        break;
+
+        // Binary, straight after a "Recording: N bytes follow" line
+        case CMD_DUMP_RECORDING: {
+            unsigned length = recorder.startDump();
+            if(length && !telemetry.logBlock("Recording", length, &recorder)){
+                recorder.cancelDump(); // Could not announce it
+            }
+            break;
+        }
 
-    bool isVehicleWaiting(){
-        //Check presence sensor
-        if(sensor.checkForVehicle()){
-            //Vehicle spotted
-            previousSensorState = true;
-            return true;
-        } else {
-            //Count vehicles
-            if(previousSensorState){
-                //Vehicle gone
-                surplusVehicleCount++;
-                if(isGreen()){
-                   if(vehicleCounterStarted){
-                    bth.printf("%s: %i vehicles left to pass.\n",junctionName,(surplusVehicleLimit - surplusVehicleCount));
-                    } 
-                }
-                previousSensorState = false;
+        // Text, straight after a "Loop timing: N bytes follow" line
+        case CMD_QUERY_TIMING: {
+            unsigned length = profiler.startReport();
+            if(length && !telemetry.logBlock("Loop timing", length, &profiler)){
+                profiler.cancelReport();
             }
-            return false;
+            break;
+        }
+
+        case CMD_RESET_TIMING: profiler.reset(); break;
+
+        case CMD_SET_TIMING: setTimingField(controller.timing, command); break;
+
+        // Until the optimizer next retimes that approach
+        case CMD_SET_VEHICLE_LIMIT: controller.approach(command.target - 1).surplusVehicleLimit = command.value; break;
+
+        case CMD_RESET_TIMERS: controller.resetTimers(); break;
+
+        // Stop all traffic (emergency situaton). Sensing carries on; the lights stay red until Go.
+        case CMD_STOP: controller.emergencyStop(); break;
+
+        // Also restarts after the conflict monitor has tripped
+        case CMD_GO: safety.clear(); controller.resume(); break;
+
+        // Joining a corridor: set the fields, then sync. Takes effect from the sync.
+        case CMD_SET_COORDINATION: {
+            CoordinationSettings settings = controller.coordination();
+            setCoordinationField(settings, command);
+            controller.coordinate(settings);
+            break;
         }
+
+        case CMD_SYNC_CYCLE: controller.syncCycle(); break;
+
+        case CMD_SET_ADAPTIVE: controller.setAdaptive(command.target != 0); break;
+
+        case CMD_SET_LOW_POWER: power.setLowPower(command.target != 0); break;
+
+        case CMD_QUERY_POWER: power.report(); break;
+
+        default: break;
     }
-    void changeRed(){
-        if(signal.isGreen){
-            signal.turnRed();
-            bth.printf("%s: Turned Red\n", junctionName);
+}
+
+// Apply every command in a frame, or none of them if any is invalid.
+void applyBatch(const CommandBatch& batch, Controller& controller){
+    StagedSettings staged = { controller.timing, controller.isAdaptive(), controller.coordination() };
+    for(int i = 0; i < batch.count; i++){
+        if(!validCommand(batch.commands[i], controller, staged)){
+            telemetry.log(MSG_FRAME_REJECTED, "Invalid command", batch.sequence);
+            return;
         }
-        
     }
-    void changeGreen(){
-        if(!signal.isGreen){
-            signal.turnGreen();
-            bth.printf("%s: Turned Green\n", junctionName);      
-        }   
+    if(!validFrame(staged, controller)){
+        telemetry.log(MSG_FRAME_REJECTED, "Invalid command", batch.sequence);
+        return;
     }
-    
-    // Vehicle counter used when a vehicle is waiting at another junction
-    void startVehicleCounter(){
-            vehicleCounterStarted = true;
-            surplusVehicleCount = 0;
+    for(int i = 0; i < batch.count; i++){
+        applyCommand(batch.commands[i], controller);
+        recorder.record(REC_COMMAND, 0, batch.commands[i].opcode);
     }
-    void stopVehicleCounter(){
-        vehicleCounterStarted = false;
+    telemetry.log(MSG_FRAME_APPLIED, 0, batch.sequence);
+}
+
+// Comms task: decode received bytes, a frame at a time, and queue each batch
+// for the control task. Whatever is left waits until control has had its turn.
+void commsTask(){
+    uint32_t began = profiler.begin();
+    char input;
+    while(rxBuffer.pop(input)){
+        CommandBatch batch;
+        FrameResult result = commandParser.feed((uint8_t)input, batch);
+        switch(result){
+            case FRAME_OK:
+            if(batches.push(batch)){
+                tasks.signal(TASK_CONTROL);
+            } else {
+                telemetry.log(MSG_FRAME_REJECTED, "Busy", batch.sequence);
+            }
+            break;
+            case FRAME_BAD_CHECKSUM: telemetry.log(MSG_FRAME_REJECTED, "Bad checksum", commandParser.lastSequence()); break;
+            case FRAME_BAD_COMMAND: telemetry.log(MSG_FRAME_REJECTED, "Unknown command", commandParser.lastSequence()); break;
+            case FRAME_TOO_MANY: telemetry.log(MSG_FRAME_REJECTED, "Too many commands", commandParser.lastSequence()); break;
+            default: break;
+        }
+        if(result != FRAME_INCOMPLETE){
+            if(!rxBuffer.empty()){
+                tasks.signal(TASK_COMMS);
+            }
+            break;
+        }
     }
+    profiler.end(STAGE_COMMANDS, began);
+}
 
+// Control task: every decoded frame is applied here, before the pass, so the
+// pass sees each batch whole. Then the signals, then the next wake-up.
+class ControlTask {
+    private:
+    Controller& controller;
 
-    void CalibrateSensor(){
-        bth.printf("%s: Calibrating sensor...\n", junctionName);
-        bth.printf("%s: Sensor Calibration - %0.2f\n",junctionName,sensor.calibrate());
-        bth.printf("%s: Sensor Calibrated.\n", junctionName);
-    }
-};
+    public:
+    ControlTask(Controller& _controller) : controller(_controller) {}
 
-// Character Mapping for 7 segment display
-struct CharacterHexCodes {
-    int ZERO, ONE, TWO, THREE, FOUR, FIVE, SIX, SEVEN, EIGHT, NINE, A, b, C, c, d, E, F, g, G, H, h, i, I, j, L, l, n, N, O, o, p, q, r, S, t, U, u, y, CLEAR;
+    void run(){
+        uint32_t events = tasks.events();
 
-    // Constructor to initialize the mappings
-    CharacterHexCodes() {
-        ZERO = 0x88; ONE = 0xBB; TWO = 0x94; THREE = 0x91; FOUR = 0xA3; FIVE = 0xC1; SIX = 0xC0; SEVEN = 0x9B; EIGHT = 0x80; NINE = 0x81; A = 0x82; b = 0xE0; C = 0xCC; 
-        c = 0xF4; d = 0xB0; E = 0xC4; F = 0xC6; g = 0x81; G = 0xC8; H = 0xA2; h = 0xE2; i = 0xDB; I = 0xBB; j = 0xD9; L = 0xEC; l = 0xEE; n = 0xF2; N = 0x8A; O = 0x88; 
-        o = 0xF0; p = 0x86; q = 0x83; r = 0xF6; S = 0xC1; t = 0xE4; U = 0xA8; u = 0xF8; y = 0xA1; CLEAR = 0xFF;
-    }
-};
+        // The monitor has already forced all red; stop the controller fighting it
+        if(events & EVENT_CONFLICT){
+            telemetry.log(MSG_CONFLICT, safety.walkWasLit() ? "Green man and signals" : "Signals", safety.conflictingGreens());
+            controller.emergencyStop();
+        }
 
-class PedestrianCrossing {
-    private:
-    DigitalOut* Red_Light;
-    DigitalOut* Green_Light;
-    CharacterHexCodes character;
-    bool isGreen;
-
-    // Start a countdown to warn pedestrian of time left to cross.
-    void startCountdown(){
-        bth.printf("Starting Pedestrian Countdown\n");
-        for(int i = 9;i>=0;i--){
-            switch (i){
-                case 9: segment = character.NINE; break;
-                case 8: segment = character.EIGHT; break;
-                case 7: segment = character.SEVEN; break;
-                case 6: segment = character.SIX; break;
-                case 5: segment = character.FIVE; break;
-                case 4: segment = character.FOUR; break;
-                case 3: segment = character.THREE; break;
-                case 2: segment = character.TWO; break;
-                case 1: segment = character.ONE; break;
-                case 0: segment = character.ZERO; break;
-                default:break;         
-            }
-            wait(1); // Wait is used here as a safety feature (we don't want accidental trigger of the lights)
+        if(events & EVENT_PED_REQUEST){
+            telemetry.log(MSG_PED_WAITING);
+            recorder.record(REC_PED_REQUEST);
         }
-        segment = character.CLEAR; // Clear 7 seg
-    }
 
-    public:
-    Timer waitingTimer;
-    bool remoteTrigger;
-
-    PedestrianCrossing(DigitalOut* _pedRedLight, DigitalOut* _pedGreenLight)
-    : Red_Light(_pedRedLight)
-    , Green_Light(_pedGreenLight){
-        isGreen = false;
-        remoteTrigger = false;
-    }
+        CommandBatch batch;
+        while(batches.pop(batch)){
+            applyBatch(batch, controller);
+        }
 
-    // Have pedestrians wait a certain amount of time before changing the lights
-    void StartWaitingTimer(){
-        bth.printf("Pedestrian Waiting...\n");
-        waitingTimer.start();
-    }
+        uint32_t began = profiler.begin();
+        controller.update();
+        profiler.end(STAGE_CONTROL, began);
 
-    void changeGreen(){
-        *Red_Light = 0;
-        *Green_Light = 1;
-        isGreen = true;
-        bth.printf("Pedestrian Crossing is Green\n");
-        startCountdown();
-        changeRed();
-    }
-    void changeRed(){
-        *Green_Light = 0;
-        *Red_Light = 1;
-        isGreen = false;
-        waitingTimer.stop();
-        waitingTimer.reset();
-        bth.printf("Pedestrian Crossing is Red\n");
+        // Wake again when the nearest running timer is due
+        began = profiler.begin();
+        power.update();
+        controller.watchDeadlines();
+        profiler.end(STAGE_DEADLINES, began);
     }
 };
 
-// Declared globally to work with interrupt
-PedestrianCrossing ped( 
-    &pedRed,
-    &pedGreen
-);
-
-//Interrupt function for pedestrian Crossing
-void StartPedTimer(){ //
-    ped.StartWaitingTimer();
-}
-
 // Start up function, for cycling through the lights to ensure connectivity
 void startup(){
-    bth.printf("Starting up...\n");
+    telemetry.log(MSG_STARTING_UP);
     int setup = 1;
     int i = 0;
     while(setup){
@@ -308,257 +402,94 @@ void startup(){
         }
         wait(0.2);
     }
-    bth.printf("Start up complete.\n");
+    telemetry.log(MSG_STARTUP_COMPLETE);
 }
 
 int main() {
 
+#ifndef TL_HOST_SIM
+    // The ticker interrupt (sensor sampling and the conflict monitor) comes
+    // first; the Bluetooth UART's (telemetry formatting) can wait for it.
+    NVIC_SetPriority(UART3_IRQn, 1);
+#endif
+    safety.start(); // Watching from power up, through the diagnostics
+
     // Run start up diagnostics
     startup();
 
-    // Instatiate a Junction object for each Junction in the Intersection
-    Junction junctionOne(
-        "Junction 1", // Junction Name
-        &irTx_J1, // IR Transmitter
-        &irRx_J1, // IR Reciever
-        &ind_J1, // Sensor Indicator Lamp
-        0.5f, // Sensor Sensitivity
-        &rLight_J1, // Traffic Signal Red Light
-        &gLight_J1, // Traffic Signal Green Light
-        5 // Surplus vehicle limit
-    );
-
-    Junction junctionTwo(
-        "Junction 2", // Junction Name
-        &irTx_J2, // IR Transmitter
-        &irRx_J2, // IR Reciever
-        &ind_J2, // Sensor Indicator Lamp
-        0.5f, // Sensor Sensitivity
-        &rLight_J2, // Traffic Signal Red Light
-        &gLight_J2, // Traffic Signal Green Light
-        4 // Surplus vehicle limit
-    );
-
-    // Calibrate both IR sensors
-    junctionOne.CalibrateSensor();
-    junctionTwo.CalibrateSensor();
-
-    Timer safePassageTimer;
-    float safePassageTime = 15; // How long the junction is green for.
-
-    Timer transitionTimer;
-    float transitionTime = 2; // How long all lights red between transitions
-
-    float pedWaitLimit = 5; // How long a pedestrian waits before changing.
-
-    Timer timeoutJunctionTimer;
-    float timeoutTime = 10; // How long before lights change back to default
+    // Instatiate a Junction object for each approach to the Intersection, in phase plan order.
+    // Everything the controller needs is static: sized and placed at link time, and
+    // nothing is allocated at run time (see NoHeap.h). They are still built here,
+    // after the start up diagnostics, so the lights come up in the same order.
+    static SITE_LOCAL Junction junctions[] = {
+        {
+            "Junction 1", // Junction Name
+            &irTx_J1, // IR Transmitter
+            &irRx_J1, // IR Reciever
+            &ind_J1, // Sensor Indicator Lamp
+            0.5f, // Sensor Sensitivity
+            &rLight_J1, // Traffic Signal Red Light
+            &gLight_J1, // Traffic Signal Green Light
+            SITE_VEHICLE_LIMITS[0], // Surplus vehicle limit (until the optimizer has measured the traffic)
+            &telemetry
+        },
+        {
+            "Junction 2", // Junction Name
+            &irTx_J2, // IR Transmitter
+            &irRx_J2, // IR Reciever
+            &ind_J2, // Sensor Indicator Lamp
+            0.5f, // Sensor Sensitivity
+            &rLight_J2, // Traffic Signal Red Light
+            &gLight_J2, // Traffic Signal Green Light
+            SITE_VEHICLE_LIMITS[1], // Surplus vehicle limit (until the optimizer has measured the traffic)
+            &telemetry
+        }
+    };
+
+    ControllerTiming timing;
+    timing.safePassageTime = SITE_SAFE_PASSAGE_TIME;
+    timing.transitionTime = SITE_TRANSITION_TIME;
+    timing.pedWaitLimit = SITE_PED_WAIT_LIMIT;
+    timing.timeoutTime = SITE_TIMEOUT_TIME;
+
+    // Green times follow the measured traffic, within these limits. The all red
+    // transition is a safety margin, so it stays fixed.
+    OptimizerSettings tuning;
+    tuning.minGreen = 7; // Shortest green held for a waiting approach
+    tuning.maxGreen = 30; // Longest green held for a waiting approach
+    tuning.lostTime = 3; // All red transition plus start-up, per phase change
+    tuning.maxCycle = 90; // Longest cycle
+    tuning.defaultHeadway = 2; // Seconds per queued vehicle, until measured
+    static SITE_LOCAL GreenTimeOptimizer optimizer(sitePlan.plan(), tuning, timing.safePassageTime);
+
+    static SITE_LOCAL Controller controller(junctions, sitePlan.plan(), &ped, timing, &scheduler, &telemetry, &optimizer, &recorder, &profiler);
+#ifdef TL_HOST_SIM
+    simController = &controller;
+#endif
+
+    profiler.start();
+
+    // Sample the sensors in the background from now on. They track ambient IR
+    // themselves, so there is no calibration stop; just let them settle and report.
+    power.start(&controller, false); // true at a solar or battery site
+    wait(0.05);
+    controller.reportSensors();
 
     // Interrupt Setup
     pedSwitch.rise(&StartPedTimer);
+    bth.attach(&BluetoothReceived, RawSerial::RxIrq);
 
     // Initial Start
     pedRed = 1;
-    junctionTwo.changeRed();
-    junctionOne.changeGreen();
-
-    while(1){
-        // If a vehicle is waiting (or has been seen waiting)
-        if(junctionOne.isVehicleWaiting() || junctionOne.changeTriggered || junctionOne.remoteTrigger){
-            // First check the junction isn't already green
-            if(!junctionOne.isGreen()){
-                
-                // Only log a waiting vehicle is there is still a vehicle and the junction is triggered. (not when remotely triggered and only log once per change) 
-                if(junctionOne.isVehicleWaiting() && !junctionOne.changeTriggered){
-                    bth.printf("Junction 1: Vehicle Waiting\n");
-                }  
-                
-                // Set the light change in motion, regardless if there is no longer a vehicle at the junction.
-                junctionOne.changeTriggered = true;
-
-                // Continue if safety timer elapsed, or vehicle limit reached, or remotely operated.
-                if(safePassageTimer.read() > safePassageTime || (junctionTwo.vehicleCounterStarted && junctionTwo.surplusVehicleCount >= junctionTwo.surplusVehicleLimit) ||
-                junctionOne.remoteTrigger){
-
-                    // If it has, change junction two to red and reset timers
-                    junctionTwo.changeRed();
-                    timeoutJunctionTimer.stop();
-                    timeoutJunctionTimer.reset();
-
-                    // Before changing green, make sure suitable time passed.
-                    if(transitionTimer.read()>transitionTime){
-
-                        // If so, change green
-                        junctionOne.changeGreen();
-                        // Reset Trigger
-                        junctionOne.changeTriggered = false;
-
-                        //Reset Timers and counters and reset remote trigger
-                        transitionTimer.stop();
-                        transitionTimer.reset();                    
-                        safePassageTimer.stop();
-                        safePassageTimer.reset();
-                        junctionTwo.stopVehicleCounter();
-                        junctionOne.remoteTrigger = false;
-
-                    } else if(transitionTimer.read()==0) {
-                        // If not, and the timer has not started, start it
-                        transitionTimer.start();
-                    }
-                } else if (safePassageTimer.read()==0){
-                    // If not, and the timer has not started, start it
-                    safePassageTimer.start();
-                }
-            }
-
-            //Only when the Junction Two is green and vehicle waiting at Junction One do we set Junction Two to count cars 
-            if(junctionTwo.isGreen() && junctionOne.isVehicleWaiting()){
-                // If the count hasn't started and there is no vehicle waiting (to account for the vehicle waiting)
-                if(!junctionTwo.vehicleCounterStarted && !junctionTwo.isVehicleWaiting()){
-                    junctionTwo.startVehicleCounter();
-                }
-                
-            }
-        }
-
-        // If a vehicle is waiting (or has been seen waiting) or is remotely triggered.
-        if(junctionTwo.isVehicleWaiting() || junctionTwo.changeTriggered || junctionTwo.remoteTrigger){
-            // First check the junction isn't already green
-
-            if(!junctionTwo.isGreen()){
-                
-                //Only log a waiting vehicle is there is still a vehicle and the junction was not already triggered
-                if(junctionTwo.isVehicleWaiting() && !junctionTwo.changeTriggered){
-                    bth.printf("Junction 2: Vehicle Waiting\n");
-                } 
-                // Set the light change in motion, regardless if there is no longer a vehicle at the junction.
-                // This stops the lights from staying red.
-                junctionTwo.changeTriggered = true;
-
-
-                // Continue if safety timer elapsed, or vehicle limit reached, or remotely operated.
-                if(safePassageTimer.read() > safePassageTime || (junctionOne.vehicleCounterStarted && junctionOne.surplusVehicleCount >= junctionOne.surplusVehicleLimit) || 
-                junctionTwo.remoteTrigger){
-
-                    // If it has, change junction one to red
-                    junctionOne.changeRed();
-
-                    // Before chaning green, make sure suitable time passed.
-                    if(transitionTimer.read()>transitionTime){
-
-                        // If so, change green
-                        junctionTwo.changeGreen();
-
-                        // Reset Trigger
-                        junctionTwo.changeTriggered = false;
-
-                        timeoutJunctionTimer.start();
-                        //Start timer to transition back, this makes it so Junction One is the primarily green.
-                        //junctionOne.changeTriggered = true;
-
-                        //Reset Timers and counters and reset remote trigger
-                        transitionTimer.stop();
-                        transitionTimer.reset();                    
-                        safePassageTimer.stop();
-                        safePassageTimer.reset();
-                        junctionOne.stopVehicleCounter();
-                        junctionTwo.remoteTrigger = false;
-
-                    } else if(transitionTimer.read()==0) {
-                        // If not, and the timer has not started, start it
-                        transitionTimer.start();
-                    }
-                } else if (safePassageTimer.read()==0){
-                    // If not, and the timer has not started, start it
-                    safePassageTimer.start();
-                }
-            } else{
-                //If a vehicle goes through the junction, reset the default timeout (this is overridden when a vehicle is waiting at Junction One)
-                timeoutJunctionTimer.stop();
-                timeoutJunctionTimer.reset();
-                timeoutJunctionTimer.start();
-            }
-
-            //Only when the Junction One is green and vehicle waiting at Junction Two do we set Junction One to count cars 
-            if(junctionOne.isGreen() && junctionTwo.isVehicleWaiting()){
-                // If the count hasn't started and there is no vehicle waiting (to account for the vehicle waiting)
-                if(!junctionOne.vehicleCounterStarted && !junctionOne.isVehicleWaiting()){
-                    junctionOne.startVehicleCounter();
-                }
-                
-            }
-        }
-
-        // If no vehicles have passed through a secondary junction, reset to default.
-        if(timeoutJunctionTimer > timeoutTime){
-            bth.printf("Lights timed out, reverting to J1\n");
-            junctionOne.remoteTrigger = true;
-            timeoutJunctionTimer.stop();
-            timeoutJunctionTimer.reset();
-        }
-
-        //Check Pedestrian Waiting Timer (or remote trigger)
-        if(ped.waitingTimer.read() > pedWaitLimit || ped.remoteTrigger){
-            junctionOne.changeRed();
-            junctionTwo.changeRed();
-
-            // Before chaning green, make sure suitable time passed.
-            transitionTimer.start();
-            if(transitionTimer > transitionTime){
-                ped.changeGreen();
-                //Reset Timers and Triggers
-                transitionTimer.stop();
-                transitionTimer.reset();
-                ped.remoteTrigger = false;
-                wait(2);
-                junctionOne.changeGreen();
-            }
-        }
-
-        // Remote Control
-        if(bth.readable()){
-            char input = bth.getc();
-
-            // Stop all timers if Bluetooth command
-            safePassageTimer.stop(); 
-            safePassageTimer.reset();
-            transitionTimer.stop();
-            transitionTimer.reset();
-            timeoutJunctionTimer.stop();
-            timeoutJunctionTimer.reset();
-
-            switch (input){
-
-                // Change to junction two.
-                case '2': junctionTwo.remoteTrigger = true; break;
-
-                // Change to junction one.
-                case '1': junctionOne.remoteTrigger = true;  break;
-
-                // Switch to pedestrian crossing
-                case 'P': ped.remoteTrigger = true; break;
-
-                // Calibrate the IR sensors on command.
-                case 'C': junctionOne.CalibrateSensor(); junctionTwo.CalibrateSensor(); break;
-
-                // Stop all traffic (emergency situaton)
-                case 'S': 
-                junctionOne.changeRed(); 
-                junctionTwo.changeRed();
-
-                // Does not restart lights until give the go-ahead
-                bth.printf("All functions stopped, enter 'G' to restart.\n"); 
-                while(1){
-                    if(bth.getc()=='G'){
-                        break;
-                    }
-                };
-                bth.printf("Functions restarted, please select a Junction to start or wait for vehicles.\n");
-                break;
-                default: break;
-            } 
-        }
-        wait(0.1); // Encountered a bug with noisy data, this small wait between checks fixes. Do not increase.
-    }
+    controller.start();
+    scheduler.post(EVENT_RERUN); // Make the first pass straight away
+
+    // Sleep until a sensor, the pedestrian switch, Bluetooth or a timer needs
+    // attention, then run whichever tasks it concerns, most urgent first
+    static SITE_LOCAL ControlTask control(controller);
+    tasks.add(TASK_CONTROL, EVENT_SENSOR | EVENT_PED_REQUEST | EVENT_DEADLINE | EVENT_RERUN | EVENT_CONFLICT,
+              callback(&control, &ControlTask::run));
+    tasks.add(TASK_COMMS, EVENT_BLUETOOTH, callback(&commsTask));
+    tasks.run();
     return 0;
   }
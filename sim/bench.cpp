@@ -0,0 +1,122 @@
+/* Traffic replay benchmark for the junction controller
+ *
+ * Runs the firmware in main.cpp, unchanged, on the simulated clock and feeds it
+ * traffic: vehicles queue at each approach and sit over its IR sensor until the
+ * signal lets them go, and pedestrians press the button and wait for the green
+ * man. At the end it reports how well the traffic was served, and how fast the
+ * simulation ran, so changes to the policy (or to the code's speed) can be
+ * compared on numbers.
+ *
+ * Build (from the repository root). The firmware's main() is renamed so the
+ * benchmark can set up the traffic first and then hand over to it:
+ *     g++ -std=c++11 -O2 -Isim -DTL_SIM_NO_SCRIPT -Dmain=tl_firmware_main -c main.cpp -o tl_firmware.o
+ *     g++ -std=c++11 -O2 -I. -Isim -DTL_SIM_NO_SCRIPT sim/bench.cpp tl_firmware.o -o tl_bench
+ *
+ * Run:
+ *     ./tl_bench <profile> [hours] [seed]
+ *     ./tl_bench trace <file> [hours]
+ * Profiles:
+ *     poisson   Random arrivals, 600/h on Junction 1 and 300/h on Junction 2
+ *     platoon   Junction 1 gets bunches of 6-10 vehicles from an upstream signal
+ *     rush      Demand ramps up to a peak and back down again
+ *     pedburst  Steady traffic, with groups of pedestrians every five minutes
+ * A trace file replays recorded arrivals, one per line:
+ *     <time_ms> vehicle <approach>   Vehicle arriving at approach 1, 2, ...
+ *     <time_ms> ped                  Pedestrian arriving at the crossing
+ */
+#include "mbed.h"
+#include "traffic.h"
+#include "Controller.h"
+#include <chrono>
+
+int tl_firmware_main();
+Controller* tl_controller();
+
+namespace {
+
+using namespace traffic;
+
+Traffic* junction;
+std::string profileName;
+uint64_t endTime;
+std::chrono::steady_clock::time_point wallStart;
+
+void printSummary(const char* label, const Summary& summary, double hours){
+    printf("  %-12s %6zu served  %7.1f /h   wait avg %6.1f s  p99 %6.1f s  max %6.1f s\n",
+        label, summary.count, summary.count / hours, summary.average, summary.p99, summary.longest);
+}
+
+void report(){
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+    double simulated = (endTime - trafficStart) / 1e6;
+    double hours = simulated / 3600;
+
+    printf("Profile %s, %.2f h of traffic\n", profileName.c_str(), hours);
+    printf("Vehicles\n");
+    std::vector<uint64_t> all;
+    size_t arrived = 0;
+    size_t queued = 0;
+    for(int a = 0; a < approachCount; a++){
+        const Lane& lane = junction->lanes[a];
+        printSummary(rig[a].name, summarise(lane.waits), hours);
+        all.insert(all.end(), lane.waits.begin(), lane.waits.end());
+        arrived += lane.nextArrival;
+        queued += lane.queue.size();
+    }
+    printSummary("All", summarise(all), hours);
+    printf("  %zu arrived, %zu still queued at the end\n", arrived, queued);
+    printf("Pedestrians\n");
+    const Crossing& crossing = junction->crossing;
+    printSummary("Crossing", summarise(crossing.waits), hours);
+    printf("  %zu arrived, %zu still waiting at the end\n", crossing.nextArrival, crossing.waiting.size());
+    printf("Controller\n");
+    const ControllerCounters& counters = tl_controller()->counters;
+    printf("  %lu surplus vehicle limit triggers, %lu phase changes, %lu timeouts\n", (unsigned long)counters.limitTriggers,
+           (unsigned long)counters.phaseChanges, (unsigned long)counters.timeouts);
+    printf("Simulation\n");
+    printf("  %.0f sensor ticks/s (%.0f x real time, %.2f s wall)\n", sim::clock().now / 1000.0 / wall, sim::clock().now / 1e6 / wall, wall);
+}
+
+} // namespace
+
+int main(int argc, char** argv){
+    if(argc < 2){
+        fprintf(stderr, "usage: %s poisson|platoon|rush|pedburst [hours] [seed]\n"
+                        "       %s trace <file> [hours]\n", argv[0], argv[0]);
+        return 1;
+    }
+    profileName = argv[1];
+    bool replay = profileName == "trace";
+    if(replay && argc < 3){
+        fprintf(stderr, "bench: trace needs a file\n");
+        return 1;
+    }
+    int hoursArg = replay ? 3 : 2;
+    double hours = argc > hoursArg ? atof(argv[hoursArg]) : (profileName == "rush" ? 2 : 1);
+    unsigned seed = !replay && argc > 3 ? (unsigned)atoi(argv[3]) : 1;
+    endTime = trafficStart + (uint64_t)(hours * 3600e6);
+
+    Demand demand;
+    if(replay){
+        if(!loadTrace(argv[2], demand)){
+            return 1;
+        }
+        profileName = std::string("trace ") + argv[2];
+    } else if(knownProfile(profileName)){
+        demand = makeDemand(profileName, endTime, seed);
+    } else {
+        fprintf(stderr, "bench: unknown profile '%s'\n", profileName.c_str());
+        return 1;
+    }
+    static Traffic traffic(demand);
+    junction = &traffic;
+    traffic.start();
+
+    sim::clock().schedule(endTime, []{
+        report();
+        sim::stop();
+    });
+
+    wallStart = std::chrono::steady_clock::now();
+    return tl_firmware_main();
+}
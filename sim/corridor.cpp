@@ -0,0 +1,433 @@
+/* Corridor simulator: a row of junctions along one road
+ *
+ * Runs several copies of the firmware in main.cpp, unchanged, one per site and
+ * each on a thread of its own (see SITE_LOCAL in main.cpp), and drives traffic
+ * along the road between them: vehicles on the main road (Junction 1 at every
+ * site) enter at the first site and drive on to the next after each one, while
+ * each site's side street (Junction 2) and crossing get traffic of their own.
+ * Every site keeps its own simulated clock; they wait for each other once a
+ * simulated second, which is safe as long as a vehicle takes longer than that
+ * to get from one site to the next.
+ *
+ * The corridor is run twice over the same traffic: once with each junction on
+ * its own, and once coordinated, with a master sending each site its offset on
+ * a common cycle over the radio link and a sync frame at the start of every
+ * cycle (CMD_SET_COORDINATION, CMD_SYNC_CYCLE). The report compares the two.
+ *
+ * Build (from the repository root), with the firmware object as for tl_bench:
+ *     g++ -std=c++11 -O2 -Isim -DTL_SIM_NO_SCRIPT -Dmain=tl_firmware_main -c main.cpp -o tl_firmware.o
+ *     g++ -std=c++11 -O2 -pthread -I. -Isim -DTL_SIM_NO_SCRIPT sim/corridor.cpp tl_firmware.o -o tl_corridor
+ *
+ * Run:
+ *     ./tl_corridor [sites] [hours] [seed]
+ */
+#include "mbed.h"
+#include "traffic.h"
+#include "CommandProtocol.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <mutex>
+#include <random>
+#include <thread>
+
+int tl_firmware_main();
+
+namespace {
+
+// The wiring, the driver and pedestrian timings, the crossing and the
+// summaries are bench.cpp's (see traffic.h). The lanes are this file's own:
+// vehicles carry their journey from site to site, and one that reaches a green
+// with nothing in front rolls through instead of stopping.
+using traffic::ApproachPins;
+using traffic::Crossing;
+using traffic::Summary;
+using traffic::radioRx;
+using traffic::step;
+using traffic::dwell;
+using traffic::startUp;
+using traffic::gap;
+using traffic::trafficStart;
+using traffic::summarise;
+const ApproachPins& mainRoad = traffic::rig[0]; // Junction 1, the default phase
+const ApproachPins& sideStreet = traffic::rig[1]; // Junction 2
+
+// Only on a corridor, in microseconds
+const uint64_t pass = 600000; // Time a vehicle that doesn't have to stop spends over the sensor
+const uint64_t travel = 20000000; // Driving time from one site to the next
+const uint64_t window = 1000000; // Sites wait for each other this often; must be under 'travel'
+
+// Demand, per hour
+const double mainRoadRate = 600; // Entering at the first site
+const double sideStreetRate = 200; // At each site
+const double pedRate = 10; // At each site
+
+// The common cycle the master sets up, in seconds
+const double cycleLength = 60;
+const double band = 30; // Main road green from the offset on
+const double minSideGreen = 7;
+const uint64_t setupAt = 4000000; // Settings go out once the firmware is listening
+const uint64_t firstSync = 10000000;
+const uint64_t linkDelay = 20000; // Radio link, master to site
+
+struct Vehicle {
+    uint64_t entered; // Time it reached the first site (main road) or its own site (side street)
+    uint64_t arrived; // Time it reached this site
+    unsigned stops; // Sites it had to stop at so far
+    bool rolling; // Reached the sensor on green with nothing in front, so it doesn't stop
+};
+
+// One approach: vehicles queue in arrival order, and the one at the front sits
+// over the sensor until the signal lets it go.
+struct Lane {
+    ApproachPins pins;
+    std::deque<Vehicle> queue;
+    bool occupied;
+    uint64_t atLineSince;
+    uint64_t clearUntil;
+    bool wasGreen;
+    uint64_t greenSince;
+};
+
+// Everything one site's thread owns; only 'inbox' is touched by another thread.
+struct Site {
+    int index;
+    bool last;
+    Lane lanes[2]; // Main road, side street
+    std::deque<Vehicle> incoming; // Main road arrivals not yet due, in time order
+    std::vector<uint64_t> sideArrivals;
+    size_t nextSide;
+    std::vector<uint64_t> peds; // Arrival times at the crossing
+    Crossing crossing;
+    std::vector<Vehicle> outbox; // Left this site since the last window, for the next one
+    std::mutex inboxLock;
+    std::vector<Vehicle> inbox; // From the site before, waiting for the next window
+
+    // Results
+    std::vector<uint64_t> through; // Corridor travel times, last site only
+    unsigned throughStops;
+    std::vector<uint64_t> sideWaits;
+    unsigned greens;
+    bool joined; // Reported being on the common cycle
+};
+
+// All sites wait here at the end of each window.
+class Barrier {
+    std::mutex lock;
+    std::condition_variable released;
+    int parties;
+    int waiting;
+    unsigned generation;
+
+    public:
+    Barrier(int _parties) : parties(_parties), waiting(0), generation(0) {}
+
+    void wait(){
+        std::unique_lock<std::mutex> guard(lock);
+        unsigned arrived = generation;
+        if(++waiting == parties){
+            waiting = 0;
+            generation++;
+            released.notify_all();
+        } else {
+            released.wait(guard, [this, arrived]{ return generation != arrived; });
+        }
+    }
+};
+
+struct Run {
+    std::vector<Site*> sites;
+    Barrier* barrier;
+    bool coordinated;
+    uint64_t endTime;
+};
+
+void poisson(std::mt19937& rng, std::vector<uint64_t>& out, uint64_t end, double perHour){
+    traffic::poisson(rng, out, end, perHour, traffic::steady);
+}
+
+void arrive(Lane& lane, Vehicle vehicle, uint64_t now){
+    vehicle.arrived = now;
+    bool green = sim::board().read(lane.pins.green) != 0;
+    vehicle.rolling = green && lane.queue.empty() && !lane.occupied && now >= lane.clearUntil;
+    vehicle.stops += !vehicle.rolling;
+    lane.queue.push_back(vehicle);
+}
+
+// Move one lane on; returns true with the vehicle that left, if one did.
+bool moveLane(Lane& lane, uint64_t now, Vehicle& left){
+    sim::Board& board = sim::board();
+    bool green = board.read(lane.pins.green) != 0;
+    if(green && !lane.wasGreen){
+        lane.greenSince = now;
+    }
+    lane.wasGreen = green;
+
+    if(!lane.occupied && !lane.queue.empty() && now >= lane.clearUntil){
+        lane.occupied = true;
+        lane.atLineSince = now;
+        board.setReflection(lane.pins.sensor, 0.80f);
+    }
+    if(!lane.occupied){
+        return false;
+    }
+    const Vehicle& front = lane.queue.front();
+    bool goes = front.rolling ? now >= lane.atLineSince + pass
+              : green && now >= lane.atLineSince + dwell && now >= lane.greenSince + startUp;
+    if(!goes){
+        return false;
+    }
+    left = front;
+    lane.queue.pop_front();
+    lane.occupied = false;
+    lane.clearUntil = now + (left.rolling ? 0 : gap);
+    board.setReflection(lane.pins.sensor, 0);
+    return true;
+}
+
+void stepTraffic(Site* site){
+    uint64_t now = sim::clock().now;
+    Lane& main = site->lanes[0];
+    Lane& side = site->lanes[1];
+
+    while(!site->incoming.empty() && site->incoming.front().arrived <= now){
+        arrive(main, site->incoming.front(), now);
+        site->incoming.pop_front();
+    }
+    while(site->nextSide < site->sideArrivals.size() && site->sideArrivals[site->nextSide] <= now){
+        Vehicle vehicle = { site->sideArrivals[site->nextSide], 0, 0, false };
+        site->nextSide++;
+        arrive(side, vehicle, now);
+    }
+
+    Vehicle left;
+    if(moveLane(main, now, left)){
+        if(site->last){
+            site->through.push_back(now - left.entered);
+            site->throughStops += left.stops;
+        } else {
+            left.arrived = now + travel; // At the next site
+            site->outbox.push_back(left);
+        }
+    }
+    if(moveLane(side, now, left)){
+        site->sideWaits.push_back(left.rolling ? 0 : (now > left.arrived + dwell ? now - left.arrived - dwell : 0));
+    }
+
+    traffic::stepCrossing(site->crossing, site->peds, now);
+
+    sim::clock().schedule(now + step, [site]{ stepTraffic(site); });
+}
+
+// End of a window: hand the vehicles that left to the next site, wait for
+// every site to get here, then take the ones handed over to this one.
+void endWindow(Run* run, Site* site){
+    uint64_t now = sim::clock().now;
+    if(!site->last){
+        Site* next = run->sites[site->index + 1];
+        std::lock_guard<std::mutex> guard(next->inboxLock);
+        next->inbox.insert(next->inbox.end(), site->outbox.begin(), site->outbox.end());
+    }
+    site->outbox.clear();
+    run->barrier->wait();
+    {
+        std::lock_guard<std::mutex> guard(site->inboxLock);
+        site->incoming.insert(site->incoming.end(), site->inbox.begin(), site->inbox.end());
+        site->inbox.clear();
+    }
+    if(now + window < run->endTime){
+        sim::clock().schedule(now + window, [run, site]{ endWindow(run, site); });
+    }
+}
+
+// A frame from the master, arriving over the radio link at 'at'.
+void sendFrame(uint64_t at, uint8_t sequence, const uint8_t* payload, uint8_t length){
+    uint8_t frame[MAX_PAYLOAD + 4];
+    int size = encodeFrame(sequence, payload, length, frame);
+    std::string bytes((const char*)frame, size);
+    sim::clock().schedule(at + linkDelay, [bytes]{
+        if(sim::board().serialOn(radioRx)){
+            sim::board().serialOn(radioRx)->deliver(bytes);
+        }
+    });
+}
+
+void coordinationPayload(uint8_t*& out, CoordinationField field, double seconds){
+    unsigned tenths = (unsigned)(seconds * 10 + 0.5);
+    *out++ = CMD_SET_COORDINATION;
+    *out++ = (uint8_t)field;
+    *out++ = (uint8_t)(tenths >> 8);
+    *out++ = (uint8_t)tenths;
+}
+
+// The master's side of the link: this site's settings, then a sync every cycle.
+void scheduleMaster(Run* run, Site* site){
+    // Green at each site as the platoon from the one before gets there
+    double offset = std::fmod(site->index * travel / 1e6, cycleLength);
+    uint8_t payload[16];
+    uint8_t* out = payload;
+    coordinationPayload(out, COORD_CYCLE, cycleLength);
+    coordinationPayload(out, COORD_OFFSET, offset);
+    coordinationPayload(out, COORD_BAND, band);
+    coordinationPayload(out, COORD_MIN_SIDE_GREEN, minSideGreen);
+    uint8_t sequence = 1;
+    sendFrame(setupAt, sequence++, payload, (uint8_t)(out - payload));
+    const uint8_t sync[] = { CMD_SYNC_CYCLE };
+    for(uint64_t t = firstSync; t < run->endTime; t += (uint64_t)(cycleLength * 1e6)){
+        sendFrame(t, sequence++, sync, sizeof(sync));
+    }
+}
+
+void runSite(Run* run, Site* site){
+    sim::stopThrows() = true;
+    sim::Board& board = sim::board();
+    const ApproachPins* pins[2] = { &mainRoad, &sideStreet };
+    for(int l = 0; l < 2; l++){
+        board.setAnalog(pins[l]->sensor, 0.10f);
+        board.setEmitter(pins[l]->sensor, pins[l]->emitter);
+    }
+    board.console = [site](const std::string& line){
+        if(line.find("Turned Green") != std::string::npos){
+            site->greens++;
+        } else if(line.find("On the common cycle") != std::string::npos){
+            site->joined = true;
+        }
+    };
+    if(run->coordinated){
+        scheduleMaster(run, site);
+    }
+    sim::clock().schedule(trafficStart, [site]{ stepTraffic(site); });
+    sim::clock().schedule(window, [run, site]{ endWindow(run, site); });
+    sim::clock().schedule(run->endTime, []{ sim::stop(); });
+    try {
+        tl_firmware_main();
+    } catch(const sim::Stopped&){
+    }
+}
+
+struct Result {
+    Summary through;
+    double stopsPerVehicle;
+    Summary side;
+    Summary peds;
+    unsigned greens;
+    int joined;
+    double wall;
+};
+
+Result simulate(int siteCount, uint64_t endTime, unsigned seed, bool coordinated){
+    std::vector<std::unique_ptr<Site> > sites;
+    Barrier barrier(siteCount);
+    Run run;
+    run.barrier = &barrier;
+    run.coordinated = coordinated;
+    run.endTime = endTime;
+    for(int i = 0; i < siteCount; i++){
+        sites.push_back(std::unique_ptr<Site>(new Site()));
+        Site& site = *sites.back();
+        site.index = i;
+        site.last = i == siteCount - 1;
+        site.lanes[0].pins = mainRoad;
+        site.lanes[1].pins = sideStreet;
+        for(int l = 0; l < 2; l++){
+            site.lanes[l].occupied = false;
+            site.lanes[l].atLineSince = 0;
+            site.lanes[l].clearUntil = 0;
+            site.lanes[l].wasGreen = false;
+            site.lanes[l].greenSince = 0;
+        }
+        site.nextSide = 0;
+        site.throughStops = 0;
+        site.greens = 0;
+        site.joined = false;
+        // The same traffic for both runs
+        std::mt19937 rng(seed * 7919 + i);
+        if(i == 0){
+            std::vector<uint64_t> entering;
+            poisson(rng, entering, endTime, mainRoadRate);
+            for(size_t v = 0; v < entering.size(); v++){
+                Vehicle vehicle = { entering[v], entering[v], 0, false };
+                site.incoming.push_back(vehicle);
+            }
+        }
+        poisson(rng, site.sideArrivals, endTime, sideStreetRate);
+        poisson(rng, site.peds, endTime, pedRate);
+        run.sites.push_back(&site);
+    }
+
+    std::chrono::steady_clock::time_point wallStart = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for(int i = 0; i < siteCount; i++){
+        threads.push_back(std::thread(runSite, &run, run.sites[i]));
+    }
+    for(size_t i = 0; i < threads.size(); i++){
+        threads[i].join();
+    }
+
+    Result result;
+    Site& last = *sites.back();
+    result.through = summarise(last.through);
+    result.stopsPerVehicle = last.through.empty() ? 0 : (double)last.throughStops / last.through.size();
+    std::vector<uint64_t> side;
+    std::vector<uint64_t> peds;
+    result.greens = 0;
+    result.joined = 0;
+    for(int i = 0; i < siteCount; i++){
+        side.insert(side.end(), sites[i]->sideWaits.begin(), sites[i]->sideWaits.end());
+        peds.insert(peds.end(), sites[i]->crossing.waits.begin(), sites[i]->crossing.waits.end());
+        result.greens += sites[i]->greens;
+        result.joined += sites[i]->joined;
+    }
+    result.side = summarise(side);
+    result.peds = summarise(peds);
+    result.wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+    return result;
+}
+
+void printRow(const char* label, const char* format, double a, double b){
+    char left[32];
+    char right[32];
+    snprintf(left, sizeof(left), format, a);
+    snprintf(right, sizeof(right), format, b);
+    printf("  %-30s %14s %14s\n", label, left, right);
+}
+
+} // namespace
+
+int main(int argc, char** argv){
+    int siteCount = argc > 1 ? atoi(argv[1]) : 3;
+    double hours = argc > 2 ? atof(argv[2]) : 1;
+    unsigned seed = argc > 3 ? (unsigned)atoi(argv[3]) : 1;
+    if(siteCount < 2 || hours <= 0){
+        fprintf(stderr, "usage: %s [sites, 2 or more] [hours] [seed]\n", argv[0]);
+        return 1;
+    }
+    uint64_t endTime = trafficStart + (uint64_t)(hours * 3600e6);
+
+    Result alone = simulate(siteCount, endTime, seed, false);
+    Result together = simulate(siteCount, endTime, seed, true);
+
+    double freeFlow = (siteCount * pass + (siteCount - 1) * travel) / 1e6;
+    printf("Corridor of %d sites, %.0f s apart, %.2f h of traffic (seed %u)\n", siteCount, travel / 1e6, hours, seed);
+    printf("Common cycle %.0f s, main road band %.0f s; %d of %d sites joined\n", cycleLength, band, together.joined, siteCount);
+    printf("  %-30s %14s %14s\n", "", "on their own", "coordinated");
+    printf("Main road, end to end\n");
+    printRow("vehicles", "%.0f", alone.through.count, together.through.count);
+    printRow("travel time avg (s)", "%.1f", alone.through.average, together.through.average);
+    printRow("delay over free flow avg (s)", "%.1f", alone.through.average - freeFlow, together.through.average - freeFlow);
+    printRow("travel time p99 (s)", "%.1f", alone.through.p99, together.through.p99);
+    printRow("stops per vehicle", "%.2f", alone.stopsPerVehicle, together.stopsPerVehicle);
+    printf("Side streets\n");
+    printRow("vehicles", "%.0f", alone.side.count, together.side.count);
+    printRow("wait avg (s)", "%.1f", alone.side.average, together.side.average);
+    printRow("wait p99 (s)", "%.1f", alone.side.p99, together.side.p99);
+    printf("Pedestrians\n");
+    printRow("served", "%.0f", alone.peds.count, together.peds.count);
+    printRow("wait avg (s)", "%.1f", alone.peds.average, together.peds.average);
+    printRow("wait max (s)", "%.1f", alone.peds.longest, together.peds.longest);
+    printf("Controllers\n");
+    printRow("greens", "%.0f", alone.greens, together.greens);
+    printRow("wall time (s)", "%.2f", alone.wall, together.wall);
+    return 0;
+}
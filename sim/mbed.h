@@ -0,0 +1,844 @@
+/* Host stand-in for mbed.h
+ *
+ * Lets the controller compile and run on a PC against a simulated clock instead
+ * of the LPC1768. Nothing here ever sleeps for real: wait() just moves the
+ * simulated clock forward, so a whole day of junction behaviour runs in seconds.
+ *
+ * Build and run (from the repository root):
+ *     g++ -std=c++11 -O2 -Isim main.cpp -o tl_sim
+ *     TL_SIM_SCRIPT=sim/scenarios/basic.txt ./tl_sim
+ *
+ * The scenario script drives the inputs, one event per line:
+ *     <time_ms> analog  <pin> <level>   Set an AnalogIn level (0.0 - 1.0)
+ *     <time_ms> noise   <pin> <amount>  Add uniform noise of +/- amount to every ADC reading
+ *     <time_ms> emitter <pin> <pin>     The AnalogIn on the first pin sees the IR emitter on the second
+ *     <time_ms> reflect <pin> <level>   Light reflected back to that AnalogIn while its emitter is on
+ *     <time_ms> digital <pin> <level>   Drive a digital input (fires InterruptIn edges)
+ *     <time_ms> serial  <pin> <text>    Deliver bytes to the Serial receiving on <pin> (\xNN for any byte)
+ *     <time_ms> stuck   <pin> <level>   Hold an output pin at a level whatever is written to it (the
+ *                                       line shorted at the board); "off" lets it go
+ *     <time_ms> trace   on|off          Print every output pin change
+ *     <time_ms> expect  <text>          A line containing <text> has been printed by then
+ *     <time_ms> absent  <text>          No line containing <text> has been printed by then
+ *     <time_ms> end                     Stop the simulation
+ * Blank lines and lines starting with '#' are ignored. Anything printed on a
+ * Serial port goes to stdout, stamped with the simulated time in seconds, with
+ * bytes that aren't printable shown as \xNN. Set TL_SIM_CAPTURE to a file name
+ * to also get the raw bytes sent, e.g. to read a recording dump with tlrec.
+ * A scenario whose expect or absent lines do not hold exits with status 1.
+ */
+#ifndef TL_SIM_MBED_H
+#define TL_SIM_MBED_H
+
+#define TL_HOST_SIM 1
+
+#include <cctype>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <vector>
+
+typedef enum {
+    p5 = 5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20,
+    p21, p22, p23, p24, p25, p26, p27, p28, p29, p30,
+    LED1, LED2, LED3, LED4, USBTX, USBRX,
+    PIN_COUNT,
+    NC = -1
+} PinName;
+
+typedef enum { PullUp, PullDown, PullNone, OpenDrain, PullDefault = PullDown } PinMode;
+
+namespace sim {
+
+inline const char* pinName(int pin){
+    static thread_local char name[8];
+    if(pin >= p5 && pin <= p30){
+        snprintf(name, sizeof(name), "p%d", pin);
+    } else if(pin >= LED1 && pin <= LED4){
+        snprintf(name, sizeof(name), "LED%d", pin - LED1 + 1);
+    } else {
+        snprintf(name, sizeof(name), "pin%d", pin);
+    }
+    return name;
+}
+
+inline int parsePin(const std::string& text){
+    if(text.size() > 1 && text[0] == 'p'){
+        return atoi(text.c_str() + 1);
+    }
+    if(text.compare(0, 3, "LED") == 0){
+        return LED1 + atoi(text.c_str() + 3) - 1;
+    }
+    return NC;
+}
+
+// Simulated time, in microseconds. One clock per thread, so independent
+// simulations can run side by side without sharing state.
+class Clock {
+    struct Event {
+        uint64_t time;
+        uint64_t seq; // Keeps events scheduled for the same instant in order
+        std::function<void()> action;
+        bool operator>(const Event& other) const {
+            return time != other.time ? time > other.time : seq > other.seq;
+        }
+    };
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event> > events;
+    uint64_t nextSeq;
+    int depth; // Non-zero while an event (i.e. an "interrupt") is running
+
+    public:
+    uint64_t now;
+
+    Clock() : nextSeq(0), depth(0), now(0) {}
+
+    void schedule(uint64_t time, std::function<void()> action){
+        Event e = { time < now ? now : time, nextSeq++, action };
+        events.push(e);
+    }
+
+    bool pending() const { return !events.empty(); }
+    uint64_t nextEventTime() const { return events.top().time; }
+    bool inInterrupt() const { return depth > 0; }
+
+    // Run every event due up to and including 'time', then settle there.
+    void advanceTo(uint64_t time){
+        if(depth > 0){
+            return; // Waiting inside an interrupt handler does not move time
+        }
+        while(!events.empty() && events.top().time <= time){
+            Event e = events.top();
+            events.pop();
+            now = e.time;
+            depth++;
+            e.action();
+            depth--;
+        }
+        if(time > now){
+            now = time;
+        }
+    }
+
+    void advanceBy(uint64_t us){ advanceTo(now + us); }
+};
+
+inline Clock& clock(){
+    static thread_local Clock c;
+    return c;
+}
+
+inline double seconds(){ return clock().now / 1e6; }
+
+class SerialPort;
+
+// Time an IR emitter takes to light up fully once switched on; reflections
+// are not seen until then. It takes as long again to fade once switched off.
+const uint64_t emitterRise = 20;
+
+// The pins of one simulated board, and the peripherals attached to them.
+class Board {
+    float level[PIN_COUNT];
+    float noise[PIN_COUNT];
+    float reflection[PIN_COUNT];
+    int emitterFor[PIN_COUNT]; // Emitter pin lighting each analog pin, or NC
+    uint64_t litSince[PIN_COUNT]; // When each output last went from 0 to lit
+    uint64_t fadedAt[PIN_COUNT]; // When each output that went back to 0 stops lighting
+    bool stuck[PIN_COUNT]; // Output held at its level by a fault, whatever is written
+    uint32_t noiseState; // Fixed seed, so every run of a scenario sees the same noise
+    std::vector<std::function<void(int, int)> > edgeHandlers[PIN_COUNT];
+    SerialPort* serialOnRx[PIN_COUNT];
+
+    public:
+    bool trace;
+    std::function<void(const std::string&)> console; // Takes each line printed on a Serial port, instead of stdout
+    FILE* capture; // Raw copy of every byte sent on a Serial port, if set
+    bool keepPrinted; // Keep every line printed, for the scenario's expectations
+    std::vector<std::string> printed;
+    int failedChecks;
+
+    Board() : noiseState(12345), trace(false), capture(0), keepPrinted(false), failedChecks(0) {
+        for(int i = 0; i < PIN_COUNT; i++){
+            level[i] = 0;
+            noise[i] = 0;
+            reflection[i] = 0;
+            emitterFor[i] = NC;
+            litSince[i] = 0;
+            fadedAt[i] = 0;
+            stuck[i] = false;
+            serialOnRx[i] = 0;
+        }
+    }
+
+    float read(int pin) const { return (pin >= 0 && pin < PIN_COUNT) ? level[pin] : 0; }
+
+    // A scenario's expect (or absent) line: has a line containing 'text' been printed yet?
+    void check(const std::string& text, bool wanted){
+        bool seen = false;
+        for(size_t i = 0; i < printed.size() && !seen; i++){
+            seen = printed[i].find(text) != std::string::npos;
+        }
+        if(seen != wanted){
+            failedChecks++;
+            fprintf(stderr, "sim: at %.3f s, %s '%s'\n", seconds(), wanted ? "still waiting for" : "did not expect", text.c_str());
+        }
+    }
+
+    // One ADC conversion: the pin level, plus the reflection once its emitter
+    // has been lit long enough (and until it has faded), plus any noise the
+    // scenario has added.
+    float sampleAnalog(int pin){
+        if(pin < 0 || pin >= PIN_COUNT){
+            return 0;
+        }
+        float value = level[pin];
+        int emitter = emitterFor[pin];
+        if(emitter != NC && (level[emitter] != 0 ? clock().now >= litSince[emitter] + emitterRise
+                                                 : clock().now < fadedAt[emitter])){
+            value += reflection[pin];
+        }
+        if(noise[pin] > 0){
+            noiseState = noiseState * 1664525u + 1013904223u;
+            value += noise[pin] * ((noiseState >> 8) / 8388608.0f - 1.0f);
+        }
+        return value;
+    }
+
+    void setNoise(int pin, float amount){
+        if(pin >= 0 && pin < PIN_COUNT){
+            noise[pin] = amount;
+        }
+    }
+
+    void setEmitter(int pin, int emitterPin){
+        if(pin >= 0 && pin < PIN_COUNT){
+            emitterFor[pin] = emitterPin;
+        }
+    }
+
+    void setReflection(int pin, float amount){
+        if(pin >= 0 && pin < PIN_COUNT){
+            reflection[pin] = amount;
+        }
+    }
+
+    // Output pins, written by the controller
+    void drive(int pin, float value){
+        if(pin < 0 || pin >= PIN_COUNT || level[pin] == value || stuck[pin]){
+            return;
+        }
+        if(level[pin] == 0){
+            litSince[pin] = clock().now;
+        } else if(value == 0){
+            fadedAt[pin] = clock().now + emitterRise;
+        }
+        level[pin] = value;
+        if(trace){
+            printf("[%10.3f] %s = %g\n", seconds(), pinName(pin), value);
+        }
+    }
+
+    // A fault holding an output at 'value', or letting it go again (where it
+    // stays until next written)
+    void setStuck(int pin, bool held, float value){
+        if(pin < 0 || pin >= PIN_COUNT){
+            return;
+        }
+        stuck[pin] = false;
+        if(held){
+            drive(pin, value);
+            stuck[pin] = true;
+        }
+    }
+
+    // Input pins, written by the scenario
+    void setAnalog(int pin, float value){
+        if(pin >= 0 && pin < PIN_COUNT){
+            level[pin] = value;
+        }
+    }
+
+    void setDigital(int pin, int value){
+        if(pin < 0 || pin >= PIN_COUNT){
+            return;
+        }
+        int previous = level[pin] != 0;
+        level[pin] = value ? 1.0f : 0.0f;
+        if(previous != (value != 0)){
+            for(size_t i = 0; i < edgeHandlers[pin].size(); i++){
+                edgeHandlers[pin][i](previous, value != 0);
+            }
+        }
+    }
+
+    void onEdge(int pin, std::function<void(int, int)> handler){
+        if(pin >= 0 && pin < PIN_COUNT){
+            edgeHandlers[pin].push_back(handler);
+        }
+    }
+
+    void attachSerial(int rxPin, SerialPort* port){
+        if(rxPin >= 0 && rxPin < PIN_COUNT){
+            serialOnRx[rxPin] = port;
+        }
+    }
+    SerialPort* serialOn(int rxPin) const {
+        return (rxPin >= 0 && rxPin < PIN_COUNT) ? serialOnRx[rxPin] : 0;
+    }
+};
+
+inline Board& board(){
+    static thread_local Board b;
+    return b;
+}
+
+// Byte stream between a Serial object and the outside world.
+class SerialPort {
+    std::deque<char> rx;
+    std::string line;
+    int baud;
+    uint64_t txIdleAt; // When the UART will have shifted out everything queued
+    static const int fifoSize = 16;
+
+    uint64_t byteTime() const { return 10000000ULL / baud; } // 8N1, so 10 bits per byte
+
+    // THRE: the interrupt fires once the FIFO has fully drained, unless more
+    // bytes were queued in the meantime.
+    void scheduleTxInterrupt(){
+        uint64_t expected = txIdleAt;
+        clock().schedule(expected, [this, expected]{
+            if(txHandler && txIdleAt == expected){
+                txHandler();
+            }
+        });
+    }
+
+    public:
+    std::function<void()> rxHandler; // The RX interrupt, if attached
+    std::function<void()> txHandler; // The TX interrupt, if attached
+
+    SerialPort(int _baud) : baud(_baud), txIdleAt(0) {}
+
+    void setBaud(int _baud){ baud = _baud; }
+
+    // Bytes arriving on the wire. With an RX interrupt attached, it runs until
+    // the handler has drained everything (or stops taking bytes).
+    void deliver(const std::string& bytes){
+        rx.insert(rx.end(), bytes.begin(), bytes.end());
+        while(rxHandler && !rx.empty()){
+            size_t before = rx.size();
+            rxHandler();
+            if(rx.size() == before){
+                break;
+            }
+        }
+    }
+    bool readable() const { return !rx.empty(); }
+    char take(){ char c = rx.front(); rx.pop_front(); return c; }
+
+    bool writeable() const { return txIdleAt <= clock().now + (fifoSize - 1) * byteTime(); }
+
+    void enableTxInterrupt(std::function<void()> handler){
+        txHandler = handler;
+        if(txHandler){
+            scheduleTxInterrupt(); // Fires as soon as the FIFO is (or already was) empty
+        }
+    }
+
+    // Queue one byte, holding the caller while the FIFO is full as the real
+    // UART would. Output reaches stdout a line at a time.
+    void transmit(char c){
+        Clock& simClock = clock();
+        if(!writeable()){
+            simClock.advanceTo(txIdleAt - (fifoSize - 1) * byteTime());
+        }
+        txIdleAt = (txIdleAt > simClock.now ? txIdleAt : simClock.now) + byteTime();
+        if(txHandler){
+            scheduleTxInterrupt();
+        }
+        if(line.empty()){
+            char stamp[24];
+            snprintf(stamp, sizeof(stamp), "[%10.3f] ", seconds());
+            line = stamp;
+        }
+        if(board().capture){
+            fputc(c, board().capture);
+        }
+        if(isprint((unsigned char)c) || c == '\n' || c == '\r' || c == '\t'){
+            line += c;
+        } else {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\x%02X", (unsigned char)c);
+            line += escaped;
+        }
+        if(c == '\n'){
+            if(board().keepPrinted){
+                board().printed.push_back(line);
+            }
+            if(board().console){
+                board().console(line);
+            } else {
+                fputs(line.c_str(), stdout);
+            }
+            line.clear();
+        }
+    }
+};
+
+// Thrown by stop() on threads that asked for it (see stopThrows()), to end
+// one simulation without ending the process.
+struct Stopped {};
+
+// Whether stop() on this thread throws Stopped rather than exiting. Host tools
+// running several sites side by side, a thread each, set it on each thread.
+inline bool& stopThrows(){
+    static thread_local bool throws = false;
+    return throws;
+}
+
+inline void stop(){
+    fflush(stdout);
+    if(stopThrows()){
+        throw Stopped();
+    }
+    exit(board().failedChecks ? 1 : 0);
+}
+
+// Expand \xNN escapes, so scripts can send binary.
+inline std::string unescape(const std::string& text){
+    std::string bytes;
+    for(size_t i = 0; i < text.size(); i++){
+        if(text[i] == '\\' && i + 4 <= text.size() && text[i + 1] == 'x'){
+            bytes += (char)strtol(text.substr(i + 2, 2).c_str(), 0, 16);
+            i += 3;
+        } else {
+            bytes += text[i];
+        }
+    }
+    return bytes;
+}
+
+// Load a scenario script and queue its events on this thread's clock.
+inline bool loadScript(const char* path){
+    std::ifstream in(path);
+    if(!in){
+        fprintf(stderr, "sim: cannot open scenario '%s'\n", path);
+        return false;
+    }
+    std::string text;
+    int lineNo = 0;
+    while(std::getline(in, text)){
+        lineNo++;
+        std::istringstream fields(text);
+        double ms;
+        std::string command;
+        if(!(fields >> ms) || !(fields >> command)){
+            continue; // Blank line or comment
+        }
+        uint64_t at = (uint64_t)(ms * 1000.0);
+        std::string arg;
+        fields >> arg;
+        int pin = parsePin(arg);
+        if(command == "analog"){
+            float value = 0;
+            fields >> value;
+            clock().schedule(at, [pin, value]{ board().setAnalog(pin, value); });
+        } else if(command == "noise"){
+            float amount = 0;
+            fields >> amount;
+            clock().schedule(at, [pin, amount]{ board().setNoise(pin, amount); });
+        } else if(command == "emitter"){
+            std::string emitter;
+            fields >> emitter;
+            int emitterPin = parsePin(emitter);
+            clock().schedule(at, [pin, emitterPin]{ board().setEmitter(pin, emitterPin); });
+        } else if(command == "reflect"){
+            float amount = 0;
+            fields >> amount;
+            clock().schedule(at, [pin, amount]{ board().setReflection(pin, amount); });
+        } else if(command == "digital"){
+            int value = 0;
+            fields >> value;
+            clock().schedule(at, [pin, value]{ board().setDigital(pin, value); });
+        } else if(command == "serial"){
+            std::string bytes;
+            std::getline(fields, bytes);
+            size_t start = bytes.find_first_not_of(' ');
+            bytes = (start == std::string::npos) ? "" : bytes.substr(start);
+            bytes = unescape(bytes);
+            clock().schedule(at, [pin, bytes]{
+                if(board().serialOn(pin)){
+                    board().serialOn(pin)->deliver(bytes);
+                }
+            });
+        } else if(command == "stuck"){
+            std::string level;
+            fields >> level;
+            bool held = level != "off";
+            float value = (float)atof(level.c_str());
+            clock().schedule(at, [pin, held, value]{ board().setStuck(pin, held, value); });
+        } else if(command == "trace"){
+            bool on = (arg == "on");
+            clock().schedule(at, [on]{ board().trace = on; });
+        } else if(command == "expect" || command == "absent"){
+            std::string text;
+            std::getline(fields, text);
+            text = arg + text;
+            bool wanted = command == "expect";
+            board().keepPrinted = true;
+            clock().schedule(at, [text, wanted]{ board().check(text, wanted); });
+        } else if(command == "end"){
+            clock().schedule(at, []{ stop(); });
+        } else {
+            fprintf(stderr, "sim: %s:%d: unknown command '%s'\n", path, lineNo, command.c_str());
+        }
+    }
+    return true;
+}
+
+// Runs before main(): pick up the scenario named in the environment, and make
+// sure the simulation ends even if the script never says so.
+struct ScriptLoader {
+    ScriptLoader(){
+        const char* path = getenv("TL_SIM_SCRIPT");
+        if(path && !loadScript(path)){
+            exit(1);
+        }
+        const char* capturePath = getenv("TL_SIM_CAPTURE");
+        if(capturePath && !(board().capture = fopen(capturePath, "wb"))){
+            fprintf(stderr, "Can't write %s\n", capturePath);
+            exit(1);
+        }
+        clock().schedule(24ULL * 3600 * 1000000, []{ stop(); });
+    }
+};
+
+} // namespace sim
+
+namespace mbed {
+
+class DigitalOut {
+    sim::Board& board;
+    int pin;
+
+    public:
+    DigitalOut(PinName _pin, int _value = 0) : board(sim::board()), pin(_pin) { write(_value); }
+
+    void write(int _value){
+        board.drive(pin, _value ? 1.0f : 0.0f);
+    }
+    // The level on the pin, as the LPC1768 reads it back; only differs from
+    // what was written when the scenario has it stuck
+    int read(){ return board.read(pin) != 0; }
+    DigitalOut& operator=(int _value){ write(_value); return *this; }
+    DigitalOut& operator=(DigitalOut& rhs){ write(rhs.read()); return *this; }
+    operator int(){ return read(); }
+};
+
+class DigitalIn {
+    sim::Board& board;
+    int pin;
+
+    public:
+    DigitalIn(PinName _pin, PinMode = PullDefault) : board(sim::board()), pin(_pin) {}
+    void mode(PinMode){}
+    int read(){ return board.read(pin) != 0; }
+    operator int(){ return read(); }
+};
+
+class AnalogIn {
+    sim::Board& board;
+    int pin;
+
+    public:
+    AnalogIn(PinName _pin) : board(sim::board()), pin(_pin) {}
+
+    // 12-bit conversion, as on the LPC1768
+    unsigned short read_u16(){
+        float value = board.sampleAnalog(pin);
+        value = value < 0 ? 0 : (value > 1 ? 1 : value);
+        unsigned short counts = (unsigned short)(value * 4095.0f + 0.5f);
+        return (unsigned short)((counts << 4) | (counts >> 8));
+    }
+    float read(){ return read_u16() / 65535.0f; }
+    operator float(){ return read(); }
+};
+
+class InterruptIn {
+    sim::Board& board;
+    int pin;
+    std::function<void()> riseHandler;
+    std::function<void()> fallHandler;
+
+    public:
+    InterruptIn(PinName _pin) : board(sim::board()), pin(_pin) {
+        board.onEdge(pin, [this](int from, int to){
+            if(!from && to && riseHandler){
+                riseHandler();
+            } else if(from && !to && fallHandler){
+                fallHandler();
+            }
+        });
+    }
+
+    void rise(void (*handler)()){ riseHandler = handler; }
+    void fall(void (*handler)()){ fallHandler = handler; }
+    template<typename T> void rise(T* object, void (T::*method)()){ riseHandler = [object, method]{ (object->*method)(); }; }
+    template<typename T> void fall(T* object, void (T::*method)()){ fallHandler = [object, method]{ (object->*method)(); }; }
+    void mode(PinMode){}
+    int read(){ return board.read(pin) != 0; }
+    operator int(){ return read(); }
+};
+
+class BusOut {
+    sim::Board& board;
+    int pins[16];
+    int count;
+    int value;
+
+    public:
+    BusOut(PinName p0, PinName p1 = NC, PinName p2 = NC, PinName p3 = NC,
+           PinName p4 = NC, PinName p5_ = NC, PinName p6_ = NC, PinName p7_ = NC,
+           PinName p8_ = NC, PinName p9_ = NC, PinName p10_ = NC, PinName p11_ = NC,
+           PinName p12_ = NC, PinName p13_ = NC, PinName p14_ = NC, PinName p15_ = NC)
+    : board(sim::board()), count(0), value(0) {
+        PinName list[16] = { p0, p1, p2, p3, p4, p5_, p6_, p7_, p8_, p9_, p10_, p11_, p12_, p13_, p14_, p15_ };
+        for(int i = 0; i < 16; i++){
+            pins[i] = list[i];
+            if(list[i] != NC){
+                count = i + 1;
+            }
+        }
+    }
+
+    void write(int _value){
+        value = _value & ((1 << count) - 1);
+        bool wasTracing = board.trace;
+        board.trace = false; // Report the bus as one value, not bit by bit
+        for(int i = 0; i < count; i++){
+            board.drive(pins[i], (float)((value >> i) & 1));
+        }
+        board.trace = wasTracing;
+        if(board.trace){
+            printf("[%10.3f] bus %s.. = 0x%02X\n", sim::seconds(), sim::pinName(pins[0]), value);
+        }
+    }
+    int read(){ return value; }
+    BusOut& operator=(int _value){ write(_value); return *this; }
+    operator int(){ return read(); }
+};
+
+class Timer {
+    uint64_t startedAt;
+    uint64_t accumulated;
+    bool running;
+
+    uint64_t elapsed() const {
+        return accumulated + (running ? sim::clock().now - startedAt : 0);
+    }
+
+    public:
+    Timer() : startedAt(0), accumulated(0), running(false) {}
+
+    void start(){
+        if(!running){
+            startedAt = sim::clock().now;
+            running = true;
+        }
+    }
+    void stop(){
+        accumulated = elapsed();
+        running = false;
+    }
+    void reset(){
+        accumulated = 0;
+        startedAt = sim::clock().now;
+    }
+    float read(){ return elapsed() / 1e6f; }
+    int read_ms(){ return (int)(elapsed() / 1000); }
+    int read_us(){ return (int)elapsed(); }
+    operator float(){ return read(); }
+};
+
+template<typename F> class Callback;
+
+template<typename R>
+class Callback<R()> {
+    std::function<R()> function;
+
+    public:
+    Callback() {}
+    Callback(R (*f)()) : function(f) {}
+    template<typename T>
+    Callback(T* object, R (T::*method)()) : function([object, method]{ return (object->*method)(); }) {}
+
+    R call() const { return function(); }
+    R operator()() const { return function(); }
+    operator bool() const { return (bool)function; }
+};
+
+inline Callback<void()> callback(void (*f)()){ return Callback<void()>(f); }
+template<typename T>
+Callback<void()> callback(T* object, void (T::*method)()){ return Callback<void()>(object, method); }
+
+// Ticker and Timeout fire from the simulated clock, as if from the us_ticker interrupt.
+class Ticker {
+    struct State {
+        Callback<void()> handler;
+        uint64_t period;
+        bool repeat;
+        unsigned generation; // Bumped on every attach/detach, so stale firings are ignored
+    };
+    std::shared_ptr<State> state;
+
+    static void fire(std::weak_ptr<State> weak, unsigned generation){
+        std::shared_ptr<State> s = weak.lock();
+        if(!s || s->generation != generation){
+            return;
+        }
+        if(s->repeat){
+            sim::clock().schedule(sim::clock().now + s->period, [weak, generation]{ fire(weak, generation); });
+        }
+        s->handler();
+    }
+
+    protected:
+    Ticker(bool repeat) : state(new State()) { state->repeat = repeat; state->generation = 0; }
+
+    public:
+    Ticker() : state(new State()) { state->repeat = true; state->generation = 0; }
+    ~Ticker(){ detach(); }
+
+    void attach_us(Callback<void()> handler, uint64_t us){
+        state->handler = handler;
+        state->period = us ? us : 1;
+        unsigned generation = ++state->generation;
+        std::weak_ptr<State> weak = state;
+        sim::clock().schedule(sim::clock().now + state->period, [weak, generation]{ fire(weak, generation); });
+    }
+    void attach(Callback<void()> handler, float seconds){ attach_us(handler, (uint64_t)(seconds * 1e6f + 0.5f)); }
+    void detach(){ state->generation++; }
+};
+
+class Timeout : public Ticker {
+    public:
+    Timeout() : Ticker(false) {}
+};
+
+class Serial {
+    sim::SerialPort port;
+
+    public:
+    enum IrqType { RxIrq = 0, TxIrq };
+
+    Serial(PinName tx, PinName rx, int baud = 9600) : port(baud) {
+        (void)tx;
+        sim::board().attachSerial(rx, &port);
+    }
+
+    void baud(int rate){ port.setBaud(rate); }
+
+    void attach(Callback<void()> handler, IrqType type = RxIrq){
+        std::function<void()> function;
+        if(handler){
+            function = handler;
+        }
+        if(type == RxIrq){
+            port.rxHandler = function;
+        } else {
+            port.enableTxInterrupt(function);
+        }
+    }
+
+    int printf(const char* format, ...){
+        char buffer[512];
+        va_list args;
+        va_start(args, format);
+        int length = vsnprintf(buffer, sizeof(buffer), format, args);
+        va_end(args);
+        if(length > (int)sizeof(buffer) - 1){
+            length = sizeof(buffer) - 1;
+        }
+        for(int i = 0; i < length; i++){
+            port.transmit(buffer[i]);
+        }
+        return length;
+    }
+
+    int putc(int c){
+        port.transmit((char)c);
+        return c;
+    }
+
+    // Blocks (in simulated time) until a byte arrives.
+    int getc(){
+        sim::Clock& clock = sim::clock();
+        while(!port.readable()){
+            if(clock.inInterrupt() || !clock.pending()){
+                sim::stop(); // Nothing will ever arrive
+            }
+            clock.advanceTo(clock.nextEventTime());
+        }
+        return port.take();
+    }
+
+    int readable(){ return port.readable(); }
+    int writeable(){ return port.writeable(); }
+};
+
+// Serial without the C stdio stream behind it (which the real one allocates on
+// the heap); the same port as far as the simulator is concerned.
+class RawSerial : public Serial {
+    public:
+    RawSerial(PinName tx, PinName rx, int baud = 9600) : Serial(tx, rx, baud) {}
+};
+
+} // namespace mbed
+
+inline void wait_us(int us){ sim::clock().advanceBy(us < 0 ? 0 : (uint64_t)us); }
+inline void wait_ms(int ms){ wait_us(ms * 1000); }
+inline void wait(float s){ wait_us((int)(s * 1e6f + 0.5f)); }
+
+// Sleep until the next interrupt, i.e. the next event on the simulated clock.
+inline void sleep(){
+    sim::Clock& clock = sim::clock();
+    if(clock.inInterrupt()){
+        return;
+    }
+    if(!clock.pending()){
+        sim::stop(); // Nothing left that could ever wake us
+    }
+    clock.advanceTo(clock.nextEventTime());
+}
+inline void deepsleep(){ sleep(); }
+
+inline uint32_t us_ticker_read(){ return (uint32_t)sim::clock().now; }
+
+// Interrupts are delivered synchronously by the simulated clock, so masking
+// them has nothing to do; the barrier still matters once threads are involved.
+inline void __disable_irq(){}
+inline void __enable_irq(){}
+inline uint32_t __get_PRIMASK(){ return 0; }
+inline void __set_PRIMASK(uint32_t){}
+inline void __DMB(){ std::atomic_thread_fence(std::memory_order_seq_cst); }
+inline uint32_t __CLZ(uint32_t value){ return value ? __builtin_clz(value) : 32; }
+
+#ifndef TL_SIM_NO_SCRIPT
+// Installed before main() runs, as the real startup code would be. Host tools
+// that drive the controller themselves define TL_SIM_NO_SCRIPT to skip this.
+static sim::ScriptLoader tl_sim_script_loader;
+#endif
+
+using namespace mbed;
+using namespace std;
+
+#endif
@@ -0,0 +1,314 @@
+/* Parameter sweep for the controller's hand-set timings
+ *
+ * Runs the firmware in main.cpp, unchanged, against the bench traffic (see
+ * traffic.h) for every combination of safe passage time, transition time,
+ * pedestrian wait limit, timeout and surplus vehicle limit on a grid, over a
+ * number of random seeds, and reports the settings that are not beaten on all
+ * three of throughput, vehicle delay and pedestrian wait by any other (the
+ * Pareto front). The optimizer is switched off (CMD_SET_ADAPTIVE) so the
+ * timings hold as set; the shipped timings with the optimizer on are run too,
+ * for comparison.
+ *
+ * Every instance runs on a thread of its own, with its own simulated clock and
+ * board and its own copy of the firmware's state (SITE_LOCAL in main.cpp), and
+ * is set up over the Bluetooth link as an operator would. A pool of one worker
+ * per core takes instances off a shared counter, so whichever worker is free
+ * takes the next one.
+ *
+ * Build (from the repository root), with the firmware object as for tl_bench:
+ *     g++ -std=c++11 -O2 -Isim -DTL_SIM_NO_SCRIPT -Dmain=tl_firmware_main -c main.cpp -o tl_firmware.o
+ *     g++ -std=c++11 -O2 -pthread -I. -Isim -DTL_SIM_NO_SCRIPT sim/sweep.cpp tl_firmware.o -o tl_sweep
+ *
+ * Run:
+ *     ./tl_sweep [profile] [hours] [seeds] [threads] [csv file]
+ * Defaults: rush, 1 hour, 3 seeds, one thread per core. The csv file gets
+ * every setting's results, not just the front.
+ */
+#include "mbed.h"
+#include "traffic.h"
+#include "CommandProtocol.h"
+#include "SiteSettings.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+int tl_firmware_main();
+
+namespace {
+
+using namespace traffic;
+
+// The grid, in seconds (vehicles for the limit)
+const float safePassageTimes[] = { 7, 10, 15, 20, 30 };
+const float transitionTimes[] = { 1, 2, 3 };
+const float pedWaitLimits[] = { 2, 5, 10 };
+const float timeoutTimes[] = { 5, 10, 20 };
+const int vehicleLimits[] = { 3, 5, 8 };
+
+const uint64_t settingsAt = 4000000; // Once the firmware is listening
+
+struct Settings {
+    float safePassageTime;
+    float transitionTime;
+    float pedWaitLimit;
+    float timeoutTime;
+    int vehicleLimit[approachCount]; // Per approach; the grid sets both the same
+    bool adaptive;
+};
+
+// What one instance measured. Vehicles and pedestrians still waiting at the
+// end count with the time they had waited so far, so starving one approach
+// doesn't look good.
+struct Outcome {
+    size_t served;
+    double delay; // Seconds, in total
+    size_t delayed; // Vehicles in 'delay'
+    double pedWait;
+    size_t peds;
+};
+
+struct Job {
+    int settings;
+    unsigned seed;
+};
+
+struct Sweep {
+    std::string profile;
+    uint64_t endTime;
+    std::vector<Settings> grid;
+    std::vector<Job> jobs;
+    std::vector<Outcome> outcomes; // One per job, each written only by its own instance
+    std::atomic<size_t> next;
+    std::atomic<size_t> done;
+};
+
+void addTiming(uint8_t*& out, TimingField field, float seconds){
+    unsigned ms = (unsigned)(seconds * 1000 + 0.5f);
+    *out++ = CMD_SET_TIMING;
+    *out++ = (uint8_t)field;
+    *out++ = (uint8_t)(ms >> 8);
+    *out++ = (uint8_t)ms;
+}
+
+// Set the instance up as an operator would, over the Bluetooth link.
+void sendSettings(const Settings& settings){
+    uint8_t payload[MAX_PAYLOAD];
+    uint8_t* out = payload;
+    *out++ = CMD_SET_ADAPTIVE;
+    *out++ = settings.adaptive ? 1 : 0;
+    if(!settings.adaptive){
+        addTiming(out, TIMING_SAFE_PASSAGE, settings.safePassageTime);
+        addTiming(out, TIMING_TRANSITION, settings.transitionTime);
+        addTiming(out, TIMING_PED_WAIT, settings.pedWaitLimit);
+        addTiming(out, TIMING_TIMEOUT, settings.timeoutTime);
+        for(int a = 0; a < approachCount; a++){
+            *out++ = CMD_SET_VEHICLE_LIMIT;
+            *out++ = (uint8_t)(a + 1);
+            *out++ = (uint8_t)settings.vehicleLimit[a];
+        }
+    }
+    uint8_t frame[MAX_PAYLOAD + 4];
+    int size = encodeFrame(1, payload, (uint8_t)(out - payload), frame);
+    std::string bytes((const char*)frame, size);
+    sim::clock().schedule(settingsAt, [bytes]{
+        if(sim::board().serialOn(radioRx)){
+            sim::board().serialOn(radioRx)->deliver(bytes);
+        }
+    });
+}
+
+// One instance, start to finish, on the calling thread.
+void runInstance(Sweep* sweep, size_t index){
+    const Job& job = sweep->jobs[index];
+    sim::stopThrows() = true;
+    Traffic traffic(makeDemand(sweep->profile, sweep->endTime, job.seed));
+    traffic.start();
+    sendSettings(sweep->grid[job.settings]);
+    sim::clock().schedule(sweep->endTime, []{ sim::stop(); });
+    try {
+        tl_firmware_main();
+    } catch(const sim::Stopped&){
+    }
+
+    uint64_t now = sim::clock().now;
+    Outcome outcome = { 0, 0, 0, 0, 0 };
+    for(int a = 0; a < approachCount; a++){
+        const Lane& lane = traffic.lanes[a];
+        outcome.served += lane.waits.size();
+        for(size_t i = 0; i < lane.waits.size(); i++){
+            outcome.delay += lane.waits[i] / 1e6;
+        }
+        for(size_t i = 0; i < lane.queue.size(); i++){
+            outcome.delay += (now - lane.queue[i]) / 1e6;
+        }
+        outcome.delayed += lane.waits.size() + lane.queue.size();
+    }
+    const Crossing& crossing = traffic.crossing;
+    for(size_t i = 0; i < crossing.waits.size(); i++){
+        outcome.pedWait += crossing.waits[i] / 1e6;
+    }
+    for(size_t i = 0; i < crossing.waiting.size(); i++){
+        outcome.pedWait += (now - crossing.waiting[i]) / 1e6;
+    }
+    outcome.peds = crossing.waits.size() + crossing.waiting.size();
+    sweep->outcomes[index] = outcome;
+}
+
+// A worker in the pool. The firmware's state is built once per thread, so
+// each instance gets a fresh thread of its own.
+void work(Sweep* sweep){
+    for(;;){
+        size_t index = sweep->next++;
+        if(index >= sweep->jobs.size()){
+            return;
+        }
+        std::thread instance(runInstance, sweep, index);
+        instance.join();
+        size_t finished = ++sweep->done;
+        if(finished * 20 / sweep->jobs.size() != (finished - 1) * 20 / sweep->jobs.size()){
+            fprintf(stderr, "\r%zu of %zu runs", finished, sweep->jobs.size());
+        }
+    }
+}
+
+// One setting, averaged over the seeds
+struct Point {
+    int settings;
+    double throughput; // Vehicles served per hour
+    double delay; // Average per vehicle, seconds
+    double pedWait; // Average per pedestrian, seconds
+};
+
+bool dominates(const Point& a, const Point& b){
+    bool noWorse = a.throughput >= b.throughput && a.delay <= b.delay && a.pedWait <= b.pedWait;
+    bool better = a.throughput > b.throughput || a.delay < b.delay || a.pedWait < b.pedWait;
+    return noWorse && better;
+}
+
+bool byDelay(const Point& a, const Point& b){
+    return a.delay < b.delay;
+}
+
+// 'separator' goes between the approaches' vehicle limits.
+void printPoint(FILE* out, const Point& point, const Settings& settings, const char* format, char separator){
+    char limits[32];
+    int length = snprintf(limits, sizeof(limits), "%d", settings.vehicleLimit[0]);
+    for(int a = 1; a < approachCount; a++){
+        length += snprintf(limits + length, sizeof(limits) - length, "%c%d", separator, settings.vehicleLimit[a]);
+    }
+    // With the optimizer on, the safe passage time and limits are only where it starts
+    fprintf(out, format, settings.adaptive ? "adaptive" : "fixed", settings.safePassageTime, settings.transitionTime,
+            settings.pedWaitLimit, settings.timeoutTime, limits, point.throughput, point.delay, point.pedWait);
+}
+
+} // namespace
+
+int main(int argc, char** argv){
+    std::string profile = argc > 1 ? argv[1] : "rush";
+    double hours = argc > 2 ? atof(argv[2]) : 1;
+    int seeds = argc > 3 ? atoi(argv[3]) : 3;
+    unsigned threads = argc > 4 ? (unsigned)atoi(argv[4]) : std::thread::hardware_concurrency();
+    const char* csvPath = argc > 5 ? argv[5] : 0;
+    if(!knownProfile(profile) || hours <= 0 || seeds < 1){
+        fprintf(stderr, "usage: %s [poisson|platoon|rush|pedburst] [hours] [seeds] [threads] [csv file]\n", argv[0]);
+        return 1;
+    }
+    threads = threads ? threads : 1;
+
+    static Sweep sweep;
+    sweep.profile = profile;
+    sweep.endTime = trafficStart + (uint64_t)(hours * 3600e6);
+    Settings shipped = { SITE_SAFE_PASSAGE_TIME, SITE_TRANSITION_TIME, SITE_PED_WAIT_LIMIT, SITE_TIMEOUT_TIME,
+                         { SITE_VEHICLE_LIMITS[0], SITE_VEHICLE_LIMITS[1] }, true }; // As main.cpp starts up
+    sweep.grid.push_back(shipped);
+    for(float safePassage : safePassageTimes){
+        for(float transition : transitionTimes){
+            for(float pedWait : pedWaitLimits){
+                for(float timeout : timeoutTimes){
+                    for(int limit : vehicleLimits){
+                        Settings settings = { safePassage, transition, pedWait, timeout, { limit, limit }, false };
+                        sweep.grid.push_back(settings);
+                    }
+                }
+            }
+        }
+    }
+    for(size_t s = 0; s < sweep.grid.size(); s++){
+        for(int seed = 1; seed <= seeds; seed++){
+            Job job = { (int)s, (unsigned)seed };
+            sweep.jobs.push_back(job);
+        }
+    }
+    sweep.outcomes.resize(sweep.jobs.size());
+    sweep.next = 0;
+    sweep.done = 0;
+
+    std::chrono::steady_clock::time_point wallStart = std::chrono::steady_clock::now();
+    std::vector<std::thread> pool;
+    for(unsigned t = 0; t < threads; t++){
+        pool.push_back(std::thread(work, &sweep));
+    }
+    for(size_t t = 0; t < pool.size(); t++){
+        pool[t].join();
+    }
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+    fprintf(stderr, "\n");
+
+    std::vector<Point> points;
+    for(size_t s = 0; s < sweep.grid.size(); s++){
+        Outcome total = { 0, 0, 0, 0, 0 };
+        for(size_t j = 0; j < sweep.jobs.size(); j++){
+            if(sweep.jobs[j].settings == (int)s){
+                const Outcome& outcome = sweep.outcomes[j];
+                total.served += outcome.served;
+                total.delay += outcome.delay;
+                total.delayed += outcome.delayed;
+                total.pedWait += outcome.pedWait;
+                total.peds += outcome.peds;
+            }
+        }
+        Point point = { (int)s, total.served / hours / seeds,
+                        total.delayed ? total.delay / total.delayed : 0,
+                        total.peds ? total.pedWait / total.peds : 0 };
+        points.push_back(point);
+    }
+
+    std::vector<Point> front;
+    for(size_t i = 0; i < points.size(); i++){
+        bool beaten = false;
+        for(size_t j = 0; j < points.size() && !beaten; j++){
+            beaten = dominates(points[j], points[i]);
+        }
+        if(!beaten){
+            front.push_back(points[i]);
+        }
+    }
+    std::sort(front.begin(), front.end(), byDelay);
+
+    const char* row = "  %-8s %7.0f %7.0f %7.0f %7.0f %6s %10.1f %9.1f %9.1f\n";
+    printf("Profile %s, %.2f h, %d seeds: %zu settings, %zu runs on %u threads in %.1f s\n",
+           profile.c_str(), hours, seeds, sweep.grid.size(), sweep.jobs.size(), threads, wall);
+    printf("Pareto front, throughput vs vehicle delay vs pedestrian wait (%zu settings)\n", front.size());
+    printf("  %-8s %7s %7s %7s %7s %6s %10s %9s %9s\n", "timing", "safe", "trans", "pedwait", "timeout", "limits",
+           "veh/h", "delay s", "ped s");
+    for(size_t i = 0; i < front.size(); i++){
+        printPoint(stdout, front[i], sweep.grid[front[i].settings], row, '/');
+    }
+    printf("Shipped timings, with the optimizer\n");
+    printPoint(stdout, points[0], sweep.grid[0], row, '/');
+
+    if(csvPath){
+        FILE* csv = fopen(csvPath, "w");
+        if(!csv){
+            fprintf(stderr, "sweep: cannot write '%s'\n", csvPath);
+            return 1;
+        }
+        fprintf(csv, "timing,safe_passage,transition,ped_wait,timeout,vehicle_limit_j1,vehicle_limit_j2,vehicles_per_hour,delay,ped_wait_avg\n");
+        for(size_t i = 0; i < points.size(); i++){
+            printPoint(csv, points[i], sweep.grid[points[i].settings], "%s,%g,%g,%g,%g,%s,%.2f,%.3f,%.3f\n", ',');
+        }
+        fclose(csv);
+    }
+    return 0;
+}
@@ -0,0 +1,193 @@
+/* Reader for traffic recordings pulled off the controller
+ *
+ * The dump command (CMD_DUMP_RECORDING) sends a "Recording: N bytes follow"
+ * line and then the recording itself, laid out as in Recording.h. Save
+ * everything that came over the serial link (or the simulator's TL_SIM_CAPTURE
+ * file) and this finds the recording in it, maps it and lists the events with
+ * their times since power up.
+ *
+ * Build (from the repository root):
+ *     g++ -std=c++11 -O2 -I. sim/tlrec.cpp -o tlrec
+ *
+ * Run:
+ *     ./tlrec <file>            List the events
+ *     ./tlrec --trace <file>    Write the arrivals as a tl_bench trace, so a
+ *                               site's traffic can be replayed against the
+ *                               controller on the bench
+ * A vehicle's arrival is taken as the time it reached the sensor, i.e. when it
+ * left less the time it sat there; a queue behind the stop line can't be seen.
+ */
+#include "Recording.h"
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const char* kindNames[REC_KIND_COUNT] = {
+    "time",
+    "departure",
+    "change",
+    "phase",
+    "vehicle limit",
+    "timeout",
+    "ped request",
+    "ped walk",
+    "ped clear",
+    "ambient",
+    "green time",
+    "stop",
+    "resume",
+    "command",
+    "value high"
+};
+
+// A record's value, with the high byte from a REC_VALUE_HIGH in front of it
+// ('high', taken and cleared here).
+uint32_t recordValue(const Record& record, uint32_t& high){
+    uint32_t value = high << 8 | record.value;
+    high = 0;
+    return value;
+}
+
+// Finds the first well formed header in the capture and copies it into
+// 'header' (the capture has no alignment to speak of). Returns the offset of
+// the records following it, or 0 if there is none.
+size_t findRecording(const uint8_t* bytes, size_t size, RecordingHeader& header){
+    for(size_t i = 0; i + sizeof(RecordingHeader) <= size; i++){
+        if(memcmp(bytes + i, RECORDING_MAGIC, sizeof(RECORDING_MAGIC)) != 0){
+            continue;
+        }
+        memcpy(&header, bytes + i, sizeof(header));
+        if(header.version != RECORDING_VERSION || header.recordSize != sizeof(Record)){
+            fprintf(stderr, "tlrec: recording at byte %zu is version %d, expected %d\n",
+                    i, header.version, RECORDING_VERSION);
+            continue;
+        }
+        return i + sizeof(header);
+    }
+    return 0;
+}
+
+void list(const RecordingHeader& header, const Record* records, unsigned count){
+    printf("%u records from %.3f s, %u lost before them\n",
+           count, header.startTime / 1000.0, header.overwritten);
+    uint64_t time = header.startTime;
+    uint32_t high = 0;
+    for(unsigned i = 0; i < count; i++){
+        const Record& record = records[i];
+        time += recordDelta(record);
+        int kind = recordKind(record);
+        if(kind == REC_TIME){
+            continue;
+        }
+        if(kind == REC_VALUE_HIGH){
+            high = record.value;
+            continue;
+        }
+        uint32_t value = recordValue(record, high);
+        printf("%10.3f  %-14s", time / 1000.0, kind < REC_KIND_COUNT ? kindNames[kind] : "?");
+        switch(kind){
+            case REC_DEPARTURE:
+                printf("approach %d, %s%.1f s on the sensor", recordIndex(record) + 1,
+                       value == RECORD_VALUE_MAX ? "at least " : "", value / 10.0);
+                break;
+            case REC_CHANGE:
+            case REC_PHASE:
+            case REC_RESUME:
+                printf("phase %d", recordIndex(record) + 1);
+                break;
+            case REC_VEHICLE_LIMIT:
+                printf("approach %d", recordIndex(record) + 1);
+                break;
+            case REC_AMBIENT:
+                printf("approach %d, %.2f", recordIndex(record) + 1, value / 100.0);
+                break;
+            case REC_GREEN_TIME:
+                printf("phase %d, %u s", recordIndex(record) + 1, value);
+                break;
+            case REC_COMMAND:
+                printf("0x%02X", value);
+                break;
+        }
+        printf("\n");
+    }
+}
+
+void trace(const RecordingHeader& header, const Record* records, unsigned count){
+    uint64_t time = header.startTime;
+    uint32_t high = 0;
+    unsigned saturated = 0;
+    for(unsigned i = 0; i < count; i++){
+        const Record& record = records[i];
+        time += recordDelta(record);
+        int kind = recordKind(record);
+        if(kind == REC_VALUE_HIGH){
+            high = record.value;
+            continue;
+        }
+        uint32_t value = recordValue(record, high);
+        if(kind == REC_DEPARTURE){
+            if(value == RECORD_VALUE_MAX){
+                saturated++;
+            }
+            uint64_t sat = value * 100;
+            printf("%llu vehicle %d\n", (unsigned long long)(time > sat ? time - sat : 0), recordIndex(record) + 1);
+        } else if(kind == REC_PED_REQUEST){
+            printf("%llu ped\n", (unsigned long long)time);
+        }
+    }
+    if(saturated){
+        fprintf(stderr, "tlrec: %u vehicles sat on the sensor longer than a record holds (%.1f s); "
+                "they arrived earlier than the trace says\n", saturated, RECORD_VALUE_MAX / 10.0);
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv){
+    bool asTrace = argc == 3 && strcmp(argv[1], "--trace") == 0;
+    if(argc != 2 && !asTrace){
+        fprintf(stderr, "usage: tlrec [--trace] <file>\n");
+        return 2;
+    }
+    const char* path = argv[argc - 1];
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+    if(fd < 0 || fstat(fd, &info) != 0 || info.st_size == 0){
+        fprintf(stderr, "tlrec: cannot read '%s'\n", path);
+        return 1;
+    }
+    size_t size = info.st_size;
+    const uint8_t* bytes = (const uint8_t*)mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(bytes == MAP_FAILED){
+        fprintf(stderr, "tlrec: cannot map '%s'\n", path);
+        return 1;
+    }
+
+    RecordingHeader header;
+    size_t start = findRecording(bytes, size, header);
+    if(!start){
+        fprintf(stderr, "tlrec: no recording in '%s'\n", path);
+        return 1;
+    }
+    const Record* records = (const Record*)(bytes + start); // Bytes only, so any alignment will do
+    size_t available = (size - start) / sizeof(Record);
+    unsigned count = header.count;
+    if(count > available){
+        fprintf(stderr, "tlrec: recording cut short, %zu of %u records\n", available, count);
+        count = available;
+    }
+
+    if(asTrace){
+        trace(header, records, count);
+    } else {
+        list(header, records, count);
+    }
+    munmap((void*)bytes, size);
+    return 0;
+}
@@ -0,0 +1,304 @@
+/* Traffic model for the host tools that drive the firmware in main.cpp
+ *
+ * Vehicles queue at each approach and sit over its IR sensor until the signal
+ * lets them go, and pedestrians press the button and wait for the green man.
+ * Demand comes from a named profile or a recorded trace. A Traffic object runs
+ * on the simulated clock of the thread that starts it and keeps everything it
+ * measures to itself, so a tool can run as many side by side as it has threads.
+ */
+#ifndef TL_SIM_TRAFFIC_H
+#define TL_SIM_TRAFFIC_H
+
+#include "mbed.h"
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+namespace traffic {
+
+// How main.cpp wires the approaches and the crossing
+struct ApproachPins {
+    PinName sensor; // AnalogIn the vehicle reflects into
+    PinName emitter;
+    PinName green; // Green signal the drivers watch
+    const char* name;
+};
+const ApproachPins rig[] = {
+    { p20, p19, p12, "Junction 1" },
+    { p18, p17, p14, "Junction 2" }
+};
+const int approachCount = 2;
+const PinName pedButton = p21;
+const PinName pedGreen = p23;
+const PinName radioRx = p10; // The Bluetooth adapter, for remote frames
+
+// Driver and pedestrian model, in microseconds
+const uint64_t step = 50000; // How often the traffic model looks at the signals
+const uint64_t dwell = 1000000; // Time a vehicle spends over the sensor before it can pull away
+const uint64_t startUp = 1000000; // Time from the green to the first vehicle moving
+const uint64_t gap = 800000; // Time from one vehicle clearing the sensor to the next reaching it
+const uint64_t pressTime = 200000; // How long the button is held
+const uint64_t repress = 30000000; // Pedestrians still waiting press again this often
+const uint64_t trafficStart = 5000000; // Leave the firmware to start up first
+
+struct Demand {
+    std::vector<uint64_t> vehicles[approachCount]; // Arrival times, sorted
+    std::vector<uint64_t> peds;
+};
+
+// Random arrivals at a rate (per hour) that may vary over time, by thinning a
+// Poisson process at the peak rate.
+inline void poisson(std::mt19937& rng, std::vector<uint64_t>& out, uint64_t end, double peakPerHour, std::function<double(uint64_t)> share){
+    if(peakPerHour <= 0){
+        return;
+    }
+    std::exponential_distribution<double> interval(peakPerHour / 3600e6);
+    std::uniform_real_distribution<double> accept(0, 1);
+    for(double t = trafficStart + interval(rng); t < end; t += interval(rng)){
+        if(accept(rng) < share((uint64_t)t)){
+            out.push_back((uint64_t)t);
+        }
+    }
+}
+
+inline double steady(uint64_t){ return 1; }
+
+inline bool knownProfile(const std::string& profile){
+    return profile == "poisson" || profile == "platoon" || profile == "rush" || profile == "pedburst";
+}
+
+// Profiles:
+//     poisson   Random arrivals, 600/h on Junction 1 and 300/h on Junction 2
+//     platoon   Junction 1 gets bunches of 6-10 vehicles from an upstream signal
+//     rush      Demand ramps up to a peak and back down again
+//     pedburst  Steady traffic, with groups of pedestrians every five minutes
+inline Demand makeDemand(const std::string& profile, uint64_t end, unsigned seed){
+    std::mt19937 rng(seed);
+    Demand demand;
+    if(profile == "poisson"){
+        poisson(rng, demand.vehicles[0], end, 600, steady);
+        poisson(rng, demand.vehicles[1], end, 300, steady);
+        poisson(rng, demand.peds, end, 20, steady);
+    } else if(profile == "platoon"){
+        // Released by a signal upstream roughly every 90 s, two seconds apart
+        std::uniform_int_distribution<int> size(6, 10);
+        std::uniform_int_distribution<int> jitter(-15, 15);
+        for(uint64_t t = trafficStart; t < end; t += (90 + jitter(rng)) * 1000000ULL){
+            int vehicles = size(rng);
+            for(int i = 0; i < vehicles && t + i * 2000000ULL < end; i++){
+                demand.vehicles[0].push_back(t + i * 2000000ULL);
+            }
+        }
+        poisson(rng, demand.vehicles[0], end, 100, steady);
+        std::sort(demand.vehicles[0].begin(), demand.vehicles[0].end());
+        poisson(rng, demand.vehicles[1], end, 250, steady);
+        poisson(rng, demand.peds, end, 10, steady);
+    } else if(profile == "rush"){
+        // A quarter of the peak in the quiet first and last fifths, a ramp each side of the peak
+        std::function<double(uint64_t)> ramp = [end](uint64_t t){
+            double x = (double)t / end;
+            double level = x < 0.2 || x > 0.8 ? 0 : (x < 0.4 ? (x - 0.2) / 0.2 : (x > 0.6 ? (0.8 - x) / 0.2 : 1));
+            return 0.25 + 0.75 * level;
+        };
+        poisson(rng, demand.vehicles[0], end, 900, ramp);
+        poisson(rng, demand.vehicles[1], end, 450, ramp);
+        poisson(rng, demand.peds, end, 30, ramp);
+    } else if(profile == "pedburst"){
+        poisson(rng, demand.vehicles[0], end, 400, steady);
+        poisson(rng, demand.vehicles[1], end, 200, steady);
+        // Groups of 4-10 arriving within 20 s (a bus stop, a school), every five minutes
+        std::uniform_int_distribution<int> size(4, 10);
+        std::uniform_int_distribution<int> within(0, 20000);
+        for(uint64_t t = trafficStart + 60000000ULL; t < end; t += 300000000ULL){
+            int peds = size(rng);
+            for(int i = 0; i < peds; i++){
+                demand.peds.push_back(t + within(rng) * 1000ULL);
+            }
+        }
+        poisson(rng, demand.peds, end, 10, steady);
+        std::sort(demand.peds.begin(), demand.peds.end());
+    }
+    return demand;
+}
+
+// Recorded arrivals, one per line:
+//     <time_ms> vehicle <approach>   Vehicle arriving at approach 1, 2, ...
+//     <time_ms> ped                  Pedestrian arriving at the crossing
+inline bool loadTrace(const char* path, Demand& demand){
+    std::ifstream in(path);
+    if(!in){
+        fprintf(stderr, "traffic: cannot open trace '%s'\n", path);
+        return false;
+    }
+    std::string text;
+    int lineNo = 0;
+    while(std::getline(in, text)){
+        lineNo++;
+        std::istringstream fields(text);
+        double ms;
+        std::string kind;
+        if(!(fields >> ms) || !(fields >> kind)){
+            continue; // Blank line or comment
+        }
+        uint64_t at = trafficStart + (uint64_t)(ms * 1000.0);
+        int approach = 0;
+        if(kind == "ped"){
+            demand.peds.push_back(at);
+        } else if(kind == "vehicle" && (fields >> approach) && approach >= 1 && approach <= approachCount){
+            demand.vehicles[approach - 1].push_back(at);
+        } else {
+            fprintf(stderr, "traffic: %s:%d: cannot read '%s'\n", path, lineNo, text.c_str());
+        }
+    }
+    for(int a = 0; a < approachCount; a++){
+        std::sort(demand.vehicles[a].begin(), demand.vehicles[a].end());
+    }
+    std::sort(demand.peds.begin(), demand.peds.end());
+    return true;
+}
+
+// One approach: vehicles queue in arrival order, and the one at the front sits
+// over the sensor until the signal is green.
+struct Lane {
+    std::deque<uint64_t> queue; // Arrival times of vehicles still to go
+    size_t nextArrival;
+    bool occupied; // Front vehicle is over the sensor
+    uint64_t atLineSince;
+    uint64_t clearUntil; // Sensor stays clear until the next vehicle has moved up
+    bool wasGreen;
+    uint64_t greenSince;
+    std::vector<uint64_t> waits; // Delay of every vehicle served, beyond the time it takes to pass
+
+    Lane() : nextArrival(0), occupied(false), atLineSince(0), clearUntil(0), wasGreen(false), greenSince(0) {}
+};
+
+struct Crossing {
+    std::vector<uint64_t> waiting; // Arrival times of pedestrians still waiting
+    size_t nextArrival;
+    uint64_t lastPress;
+    std::vector<uint64_t> waits;
+
+    Crossing() : nextArrival(0), lastPress(0) {}
+};
+
+inline void press(Crossing& crossing){
+    sim::board().setDigital(pedButton, 1);
+    sim::clock().schedule(sim::clock().now + pressTime, []{ sim::board().setDigital(pedButton, 0); });
+    crossing.lastPress = sim::clock().now;
+}
+
+// Move the crossing on to 'now': pedestrians due by then arrive, the first one
+// to wait presses the button, and they press again every so often until the
+// green man lets them all go.
+inline void stepCrossing(Crossing& crossing, const std::vector<uint64_t>& arrivals, uint64_t now){
+    bool walk = sim::board().read(pedGreen) != 0;
+    while(crossing.nextArrival < arrivals.size() && arrivals[crossing.nextArrival] <= now){
+        uint64_t arrived = arrivals[crossing.nextArrival++];
+        if(walk){
+            crossing.waits.push_back(0);
+        } else {
+            if(crossing.waiting.empty()){
+                press(crossing);
+            }
+            crossing.waiting.push_back(arrived);
+        }
+    }
+    if(walk){
+        for(size_t i = 0; i < crossing.waiting.size(); i++){
+            crossing.waits.push_back(now - crossing.waiting[i]);
+        }
+        crossing.waiting.clear();
+    } else if(!crossing.waiting.empty() && now >= crossing.lastPress + repress){
+        press(crossing);
+    }
+}
+
+// The traffic at one junction, played against the board of the thread that
+// calls start().
+class Traffic {
+    Demand demand;
+
+    // Move the traffic on by one step, then come back for the next.
+    void stepTraffic(){
+        sim::Board& board = sim::board();
+        uint64_t now = sim::clock().now;
+
+        for(int a = 0; a < approachCount; a++){
+            Lane& lane = lanes[a];
+            const std::vector<uint64_t>& arrivals = demand.vehicles[a];
+            while(lane.nextArrival < arrivals.size() && arrivals[lane.nextArrival] <= now){
+                lane.queue.push_back(arrivals[lane.nextArrival++]);
+            }
+            bool green = board.read(rig[a].green) != 0;
+            if(green && !lane.wasGreen){
+                lane.greenSince = now;
+            }
+            lane.wasGreen = green;
+
+            if(!lane.occupied && !lane.queue.empty() && now >= lane.clearUntil){
+                lane.occupied = true;
+                lane.atLineSince = now;
+                board.setReflection(rig[a].sensor, 0.80f);
+            }
+            if(lane.occupied && green && now >= lane.atLineSince + dwell && now >= lane.greenSince + startUp){
+                uint64_t arrived = lane.queue.front();
+                lane.queue.pop_front();
+                lane.waits.push_back(now > arrived + dwell ? now - arrived - dwell : 0);
+                lane.occupied = false;
+                lane.clearUntil = now + gap;
+                board.setReflection(rig[a].sensor, 0);
+            }
+        }
+
+        stepCrossing(crossing, demand.peds, now);
+
+        sim::clock().schedule(now + step, [this]{ stepTraffic(); });
+    }
+
+    public:
+    Lane lanes[approachCount];
+    Crossing crossing;
+
+    Traffic(const Demand& _demand) : demand(_demand) {}
+
+    // Set the sensors up as on the bench (a little ambient IR on each), quieten
+    // the telemetry, and start the traffic. What the controller decided is read
+    // from its own counters (tl_controller() in main.cpp): telemetry drops
+    // lines when the link is busy, so counting them would come up short.
+    void start(){
+        sim::Board& board = sim::board();
+        for(int a = 0; a < approachCount; a++){
+            board.setAnalog(rig[a].sensor, 0.10f);
+            board.setEmitter(rig[a].sensor, rig[a].emitter);
+        }
+        board.console = [](const std::string&){};
+        sim::clock().schedule(trafficStart, [this]{ stepTraffic(); });
+    }
+};
+
+struct Summary {
+    size_t count;
+    double average; // Seconds
+    double p99;
+    double longest;
+};
+
+inline Summary summarise(std::vector<uint64_t> waits){
+    Summary summary = { waits.size(), 0, 0, 0 };
+    if(waits.empty()){
+        return summary;
+    }
+    std::sort(waits.begin(), waits.end());
+    double total = 0;
+    for(size_t i = 0; i < waits.size(); i++){
+        total += waits[i];
+    }
+    summary.average = total / waits.size() / 1e6;
+    summary.p99 = waits[(size_t)std::ceil(0.99 * waits.size()) - 1] / 1e6;
+    summary.longest = waits.back() / 1e6;
+    return summary;
+}
+
+} // namespace traffic
+
+#endif